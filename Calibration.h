@@ -0,0 +1,488 @@
+// Per-channel calibration computed from the adcVal samples of a file (--calibrate) and kept in a small versioned text
+// table next to it (<file>.wcal), e.g.
+//   # Calibration of run42.root
+//   version = 1
+//   geometry = standard
+//   geometry_hash = 2166136261
+//   source_size = 104857600
+//   source_mtime = 1718000000
+//   events = 100000
+//   pulse_threshold = 20
+//   # adc_channel  channel  baseline  noise  gain  spe_amplitude  spe_pulses
+//   channel = 0 P1 201.37 1.82 131.6 37.4 20114
+// For every ADC channel:
+//   baseline       median of the baseline samples of all events (robust against pulses in the baseline window)
+//   noise          robust RMS of the baseline samples, 1.4826 x their median absolute deviation
+//   gain           single-photoelectron charge (ADC counts x samples): the first peak beyond the threshold noise
+//                  in the charge spectrum of the isolated pulses found with the pulse threshold, 0 if not found
+//   spe_amplitude  mean height of the pulses in that peak, the ADC counts of one photoelectron
+// The table of each file is computed once, in parallel over its events, and is stale when the file, the geometry or
+// the pulse threshold changes. Calibrated plots (--calibrated) load the tables once and draw every channel as its baseline-subtracted
+// signal in photoelectrons; --calibration <table> applies one table (e.g. of an LED run) to every file of a run.
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <sys/stat.h>
+#include <TStopwatch.h>
+#include "DetectorGeometry.h"
+#include "RunFiles.h"
+#include "WaveformReader.h"
+#include "WorkerPool.h"
+#include "PulseFinder.h"
+
+const uint32_t calibrationVersion = 1;
+const double defaultADCFloor = 170;          // Bottom of the y axis of uncalibrated plots, in ADC counts
+const int calibrationADCBins = 16384;        // Baseline samples are histogrammed in ADC counts 0-16383
+const int calibrationChargeBins = 4096;      // Pulse charges in ADC counts x samples 0-4095
+const Long64_t minCalibrationPulses = 100;   // Isolated pulses needed to measure the gain
+
+struct ChannelCalibration {
+    float baseline = 0;
+    float noise = 0;
+    float gain = 0;         // 0 if not measured
+    float speAmplitude = 0; // 0 if not measured
+    Long64_t nPulses = 0;   // Pulses in the single-photoelectron peak
+};
+
+// How the samples of a channel are drawn: (sample - offset) * scale, on a y axis from floor to ceiling
+struct ChannelScale {
+    double offset = 0;
+    double scale = 1;
+    double floor = defaultADCFloor;
+    double ceiling = 0;
+    bool calibrated = false;     // Baseline-subtracted with a calibration table
+    bool photoelectrons = false; // In photoelectrons, otherwise ADC counts
+
+    double apply(double value) const {
+        return (value - offset) * scale;
+    }
+
+    const char *unit() const {
+        return photoelectrons ? "PE" : "ADC";
+    }
+
+    // y-axis title of a calibrated channel
+    const char *axisTitle() const {
+        return photoelectrons ? "Signal (PE)" : "Signal above baseline (ADC)";
+    }
+};
+
+// Histograms of one worker's events, merged into the table at the end
+struct CalibrationAccumulator {
+    int nChannels = 0;
+    Long64_t nEvents = 0;
+    std::vector<uint32_t> baselineCounts; // [channel][ADC value]
+    std::vector<uint32_t> chargeCounts;   // [channel][charge] of isolated pulses
+    std::vector<double> amplitudeSums;    // [channel][charge] sum of the heights of those pulses
+
+    explicit CalibrationAccumulator(int channels = 0)
+        : nChannels(channels), baselineCounts((size_t)channels * calibrationADCBins, 0),
+          chargeCounts((size_t)channels * calibrationChargeBins, 0), amplitudeSums((size_t)channels * calibrationChargeBins, 0) {}
+
+    // Add the loaded event; features is scratch space for the pulses
+    void fill(const WaveformReader &reader, EventFeatures &features, const PulseFinderConfig &config) {
+        reader.findPulses(features, config);
+        for (int channel = 0; channel < nChannels; channel++) {
+            const Short_t *samples = reader.samples(channel);
+            uint32_t *counts = &baselineCounts[(size_t)channel * calibrationADCBins];
+            for (int k = 0; k < nBaselineSamples; k++) {
+                counts[std::min(std::max((int)samples[k], 0), calibrationADCBins - 1)]++;
+            }
+            for (int i = features.firstPulse[channel]; i < features.firstPulse[channel + 1]; i++) {
+                const Pulse &pulse = features.pulses[i];
+                int bin = (int)pulse.charge;
+                if ((pulse.flags & pulsePileUp) || bin < 0 || bin >= calibrationChargeBins) continue;
+                chargeCounts[(size_t)channel * calibrationChargeBins + bin]++;
+                amplitudeSums[(size_t)channel * calibrationChargeBins + bin] += pulse.amplitude;
+            }
+        }
+        nEvents++;
+    }
+
+    void add(const CalibrationAccumulator &other) {
+        for (size_t i = 0; i < baselineCounts.size(); i++) baselineCounts[i] += other.baselineCounts[i];
+        for (size_t i = 0; i < chargeCounts.size(); i++) chargeCounts[i] += other.chargeCounts[i];
+        for (size_t i = 0; i < amplitudeSums.size(); i++) amplitudeSums[i] += other.amplitudeSums[i];
+        nEvents += other.nEvents;
+    }
+};
+
+// Median of a histogram of integer values, interpolated within the bin holding it
+inline double histogramMedian(const uint32_t *counts, int bins) {
+    uint64_t total = 0;
+    for (int i = 0; i < bins; i++) total += counts[i];
+    if (total == 0) return 0;
+    double half = total / 2.0;
+    uint64_t below = 0;
+    for (int i = 0; i < bins; i++) {
+        if (below + counts[i] >= half) return i - 0.5 + (half - below) / counts[i];
+        below += counts[i];
+    }
+    return bins - 1;
+}
+
+// Single-photoelectron peak of a charge spectrum: the lowest local maximum of the smoothed spectrum that reaches a
+// third of its highest bin, unless a valley follows it and the highest bin beyond is not its two-photoelectron peak
+// (about twice the charge and lower); then the first maximum is noise triggering at the threshold and the bin beyond
+// is the peak. The charge is refined to the mean within +-30% of the peak. Returns false with too few pulses.
+inline bool findSinglePhotoelectronPeak(const uint32_t *counts, const double *amplitudeSums, ChannelCalibration &calibration) {
+    const int halfWidth = 5;
+    std::vector<double> smoothed(calibrationChargeBins, 0);
+    double highest = 0;
+    for (int i = 0; i < calibrationChargeBins; i++) {
+        int first = std::max(i - halfWidth, 0), last = std::min(i + halfWidth, calibrationChargeBins - 1);
+        for (int j = first; j <= last; j++) smoothed[i] += counts[j];
+        smoothed[i] /= last - first + 1;
+        highest = std::max(highest, smoothed[i]);
+    }
+    if (highest == 0) return false;
+
+    int peak = -1;
+    for (int i = 1; i < calibrationChargeBins && peak < 0; i++) {
+        if (smoothed[i] < highest / 3) continue;
+        bool localMaximum = true;
+        for (int j = std::max(i - halfWidth, 0); j <= std::min(i + halfWidth, calibrationChargeBins - 1); j++) {
+            if (smoothed[j] > smoothed[i]) localMaximum = false;
+        }
+        if (localMaximum) peak = i;
+    }
+    if (peak < 0) return false;
+
+    // Walk down to the valley until the spectrum clearly rises again
+    int valley = peak, i = peak + 1;
+    for (; i < calibrationChargeBins; i++) {
+        if (smoothed[i] < smoothed[valley]) valley = i;
+        else if (smoothed[i] > 1.2 * smoothed[valley] + 1) break;
+    }
+    if (i < calibrationChargeBins) {
+        int next = (int)(std::max_element(smoothed.begin() + valley, smoothed.end()) - smoothed.begin());
+        bool twoPhotoelectrons = next > 1.6 * peak && next < 2.4 * peak && smoothed[next] < smoothed[peak];
+        if (!twoPhotoelectrons) peak = next;
+    }
+
+    int first = (int)(0.7 * peak), last = std::min((int)(1.3 * peak) + 1, calibrationChargeBins - 1);
+    double n = 0, chargeSum = 0, amplitudeSum = 0;
+    for (int i = first; i <= last; i++) {
+        n += counts[i];
+        chargeSum += counts[i] * (i + 0.5);
+        amplitudeSum += amplitudeSums[i];
+    }
+    if (n < minCalibrationPulses) return false;
+    calibration.gain = chargeSum / n;
+    calibration.speAmplitude = amplitudeSum / n;
+    calibration.nPulses = (Long64_t)n;
+    return true;
+}
+
+struct CalibrationTable {
+    std::vector<ChannelCalibration> channels; // Indexed by ADC channel
+    Long64_t nEvents = 0;
+    double pulseThreshold = 0;
+
+    bool empty() const {
+        return channels.empty();
+    }
+
+    // Baseline-subtracted scaling of an ADC channel, in photoelectrons when the gain is known. The y axis starts
+    // five noise RMS below the baseline.
+    ChannelScale scale(int adcIndex) const {
+        ChannelScale result;
+        const ChannelCalibration &c = channels[adcIndex];
+        result.calibrated = true;
+        result.offset = c.baseline;
+        result.photoelectrons = c.speAmplitude > 0;
+        result.scale = result.photoelectrons ? 1.0 / c.speAmplitude : 1.0;
+        result.floor = -5 * std::max(c.noise, 1.0f) * result.scale;
+        return result;
+    }
+
+    // Baseline, noise and gain of every channel from the accumulated histograms
+    void compute(const CalibrationAccumulator &accumulator, double threshold) {
+        channels.assign(accumulator.nChannels, ChannelCalibration());
+        nEvents = accumulator.nEvents;
+        pulseThreshold = threshold;
+        std::vector<uint32_t> deviations(calibrationADCBins);
+        for (int channel = 0; channel < accumulator.nChannels; channel++) {
+            ChannelCalibration &c = channels[channel];
+            const uint32_t *counts = &accumulator.baselineCounts[(size_t)channel * calibrationADCBins];
+            c.baseline = histogramMedian(counts, calibrationADCBins);
+
+            // Median absolute deviation, from the same histogram folded at the (integer) median
+            std::fill(deviations.begin(), deviations.end(), 0);
+            int median = (int)std::lround(c.baseline);
+            for (int i = 0; i < calibrationADCBins; i++) deviations[std::abs(i - median)] += counts[i];
+            c.noise = 1.4826 * std::max(histogramMedian(deviations.data(), calibrationADCBins), 0.0);
+
+            findSinglePhotoelectronPeak(&accumulator.chargeCounts[(size_t)channel * calibrationChargeBins],
+                                        &accumulator.amplitudeSums[(size_t)channel * calibrationChargeBins], c);
+        }
+    }
+
+    // Accumulate all events with one pass over the file, splitting the entries into contiguous blocks per worker
+    bool build(const char *fileName, const DetectorGeometry &geometry, const PulseFinderConfig &config, int nWorkers) {
+        Long64_t n = 0;
+        {
+            WaveformReader reader;
+            if (!reader.open(fileName, geometry)) return false;
+            n = reader.nEntries;
+        }
+        if (nWorkers < 1) nWorkers = defaultWorkerCount();
+        if (nWorkers > n) nWorkers = n > 0 ? (int)n : 1;
+
+        std::vector<CalibrationAccumulator> parts(nWorkers, CalibrationAccumulator(geometry.nChannels));
+        std::atomic<bool> ok(true);
+        runWorkers(nWorkers, [&](int worker) {
+            Long64_t first = n * worker / nWorkers;
+            Long64_t last = n * (worker + 1) / nWorkers - 1;
+            WaveformReader reader;
+            if (!reader.open(fileName, geometry)) {
+                ok = false;
+                return;
+            }
+            reader.setEntryRange(first, last);
+            EventFeatures features;
+            for (Long64_t EventID = first; EventID <= last; EventID++) {
+                if (!reader.load(EventID)) {
+                    ok = false;
+                    return;
+                }
+                parts[worker].fill(reader, features, config);
+            }
+        });
+        if (!ok) return false;
+
+        for (int worker = 1; worker < nWorkers; worker++) parts[0].add(parts[worker]);
+        compute(parts[0], config.threshold);
+        return true;
+    }
+
+    bool write(const std::string &tableFileName, const std::string &sourceName, const struct stat &source, const DetectorGeometry &geometry) const {
+        std::string partialFileName = tableFileName + ".partial";
+        std::ofstream out(partialFileName);
+        if (!out) {
+            std::cerr << "Error writing calibration table: " << tableFileName << std::endl;
+            return false;
+        }
+        out << "# Calibration of " << sourceName << std::endl
+            << "version = " << calibrationVersion << std::endl
+            << "geometry = " << geometry.name << std::endl
+            << "geometry_hash = " << geometry.hash() << std::endl
+            << "source_size = " << (long long)source.st_size << std::endl
+            << "source_mtime = " << (long long)source.st_mtime << std::endl
+            << "events = " << nEvents << std::endl
+            << "pulse_threshold = " << pulseThreshold << std::endl
+            << "# adc_channel  channel  baseline  noise  gain  spe_amplitude  spe_pulses" << std::endl;
+        for (size_t adcIndex = 0; adcIndex < channels.size(); adcIndex++) {
+            const ChannelCalibration &c = channels[adcIndex];
+            char line[160];
+            snprintf(line, sizeof(line), "channel = %zu %s %.3f %.3f %.2f %.3f %lld", adcIndex, padName(geometry, (int)adcIndex).c_str(),
+                     c.baseline, c.noise, c.gain, c.speAmplitude, (long long)c.nPulses);
+            out << line << std::endl;
+        }
+        out.close();
+        if (!out || rename(partialFileName.c_str(), tableFileName.c_str()) != 0) {
+            std::cerr << "Error writing calibration table: " << tableFileName << std::endl;
+            remove(partialFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Read a table; fails quietly if it is missing, has another version or geometry or was computed with another
+    // pulse threshold, and, given the stat of the ROOT file it is meant for, if it was computed from another state of that file
+    bool read(const std::string &tableFileName, const struct stat *source, const DetectorGeometry &geometry, const PulseFinderConfig &config) {
+        std::ifstream in(tableFileName);
+        if (!in) return false;
+        channels.clear();
+        long long version = -1, hash = -1, size = -1, mtime = -1;
+        pulseThreshold = -1;
+        std::string line;
+        while (std::getline(in, line)) {
+            line = line.substr(0, line.find('#'));
+            size_t equals = line.find('=');
+            if (equals == std::string::npos) continue;
+            std::istringstream keyWords(line.substr(0, equals)), words(line.substr(equals + 1));
+            std::string key;
+            keyWords >> key;
+            if (key == "version") words >> version;
+            else if (key == "geometry_hash") words >> hash;
+            else if (key == "source_size") words >> size;
+            else if (key == "source_mtime") words >> mtime;
+            else if (key == "events") words >> nEvents;
+            else if (key == "pulse_threshold") words >> pulseThreshold;
+            else if (key == "channel") {
+                size_t adcIndex;
+                std::string name;
+                ChannelCalibration c;
+                if (!(words >> adcIndex >> name >> c.baseline >> c.noise >> c.gain >> c.speAmplitude >> c.nPulses) ||
+                    adcIndex != channels.size()) {
+                    return false;
+                }
+                channels.push_back(c);
+            }
+        }
+        // The threshold is written with the default stream precision
+        bool sameThreshold = std::fabs(pulseThreshold - config.threshold) <= 1e-5 * std::max(1.0, std::fabs(config.threshold));
+        if (version != calibrationVersion || hash != (long long)geometry.hash() || (int)channels.size() != geometry.nChannels || !sameThreshold ||
+            (source && (size != (long long)source->st_size || mtime != (long long)source->st_mtime))) {
+            channels.clear();
+            return false;
+        }
+        return true;
+    }
+
+private:
+    // Pad name of the detector channel read out on an ADC channel (P3, S1), or - for an unused channel
+    static std::string padName(const DetectorGeometry &geometry, int adcIndex) {
+        for (int detectorChannel = 0; detectorChannel < geometry.nDetectorChannels(); detectorChannel++) {
+            if (geometry.adcChannel(detectorChannel) == adcIndex) {
+                return (geometry.isSiPM(detectorChannel) ? "S" : "P") + std::to_string(geometry.channelNumber(detectorChannel));
+            }
+        }
+        return "-";
+    }
+};
+
+inline std::string calibrationFileName(const char *fileName) {
+    return std::string(fileName) + ".wcal";
+}
+
+// Load the calibration table of fileName, computing (and saving) it first if it is missing, stale or rebuild is set
+inline bool loadCalibration(const char *fileName, const DetectorGeometry &geometry, const PulseFinderConfig &config, CalibrationTable &table,
+                            int nWorkers, bool rebuild) {
+    struct stat source;
+    if (stat(fileName, &source) != 0) {
+        std::cerr << "Error opening file: " << fileName << std::endl;
+        return false;
+    }
+
+    std::string tableFileName = calibrationFileName(fileName);
+    if (!rebuild && table.read(tableFileName, &source, geometry, config)) return true;
+
+    std::cout << "Calibrating, writing " << tableFileName << std::endl;
+    if (!table.build(fileName, geometry, config, nWorkers)) return false;
+    table.write(tableFileName, fileName, source, geometry); // The table is still usable in memory if it can't be written
+    return true;
+}
+
+// Calibration tables of the files of a run, or one table for all of them
+struct RunCalibration {
+    std::vector<CalibrationTable> files;
+
+    bool empty() const {
+        return files.empty();
+    }
+
+    // Table of a file of the run (by index), null when plots are not calibrated
+    const CalibrationTable *forFile(int file) const {
+        if (files.empty()) return nullptr;
+        return &files[files.size() == 1 ? 0 : std::max(file, 0)];
+    }
+};
+
+// Load (or with rebuild compute) the tables of all files of a run, one file after the other, each split over all
+// workers. With tableFileName, that one table is used for every file instead.
+inline bool loadRunCalibration(const RunFiles &run, const DetectorGeometry &geometry, const PulseFinderConfig &config, const char *tableFileName,
+                               RunCalibration &calibration, int nWorkers, bool rebuild) {
+    calibration.files.assign(tableFileName ? 1 : run.nFiles(), CalibrationTable());
+    if (tableFileName) {
+        if (!calibration.files[0].read(tableFileName, nullptr, geometry, config)) {
+            std::cerr << "Error: can't read calibration table " << tableFileName << " for detector geometry '" << geometry.name
+                      << "' and pulse threshold " << config.threshold << std::endl;
+            return false;
+        }
+        return true;
+    }
+    TStopwatch timer;
+    for (int file = 0; file < run.nFiles(); file++) {
+        if (!loadCalibration(run.fileNames[file].c_str(), geometry, config, calibration.files[file], nWorkers, rebuild)) return false;
+    }
+    timer.Stop();
+    if (rebuild) {
+        double seconds = timer.RealTime();
+        std::cout << "Calibrated " << run.nEntries() << " events in " << seconds << " s (" << (seconds > 0 ? run.nEntries() / seconds : 0)
+                  << " events/s)" << std::endl;
+    }
+    return true;
+}
+
+// Per detector channel: baseline, noise and gain averaged over the files of the run, and how far the baseline drifts
+inline void printRunCalibration(const RunCalibration &calibration, const DetectorGeometry &geometry) {
+    std::cout << "Calibration (baseline and noise in ADC counts, gain in ADC counts x samples per photoelectron):" << std::endl;
+    for (int detectorChannel = 0; detectorChannel < geometry.nDetectorChannels(); detectorChannel++) {
+        int adcIndex = geometry.adcChannel(detectorChannel);
+        double baseline = 0, noise = 0, gain = 0, lowest = 1e9, highest = -1e9;
+        int nGains = 0;
+        for (const CalibrationTable &table : calibration.files) {
+            const ChannelCalibration &c = table.channels[adcIndex];
+            baseline += c.baseline;
+            noise += c.noise;
+            lowest = std::min(lowest, (double)c.baseline);
+            highest = std::max(highest, (double)c.baseline);
+            if (c.gain > 0) {
+                gain += c.gain;
+                nGains++;
+            }
+        }
+        int n = (int)calibration.files.size();
+        char line[160];
+        snprintf(line, sizeof(line), "  %-8s baseline %8.2f (drift %.2f)  noise %6.2f  gain %s", geometry.channelName(detectorChannel).c_str(),
+                 baseline / n, highest - lowest, noise / n, nGains > 0 ? std::to_string(gain / nGains).c_str() : "not measured");
+        std::cout << line << std::endl;
+    }
+}
+
+// y-axis scaling of the plots of an event: raw ADC counts from defaultADCFloor, or with the calibration table of
+// the event's file the baseline-subtracted signal of every channel
+struct EventScale {
+    const CalibrationTable *calibration = nullptr; // Null for raw ADC counts
+    double maximum = 0;    // Top of the y axis, in ADC counts or, calibrated, photoelectrons
+    double maximumADC = 0; // Top of the y axis of calibrated channels without a gain, in ADC counts above baseline
+
+    bool calibrated() const {
+        return calibration != nullptr;
+    }
+
+    ChannelScale channel(int adcIndex) const {
+        if (!calibration) {
+            ChannelScale raw;
+            raw.ceiling = maximum;
+            return raw;
+        }
+        ChannelScale scale = calibration->scale(adcIndex);
+        scale.ceiling = scale.photoelectrons ? maximum : maximumADC;
+        return scale;
+    }
+};
+
+// Scale of the loaded event: the y axis reaches the highest peak, rounded up to 10 ADC counts (or 1 photoelectron)
+inline EventScale eventScale(const EventFeatures &features, const CalibrationTable *calibration) {
+    EventScale scale;
+    scale.calibration = calibration;
+    if (!calibration) {
+        scale.maximum = std::ceil((std::max(0, (int)features.maxADC) + 0.5) / 10) * 10;
+        return scale;
+    }
+    double highest = 0, highestADC = 0;
+    for (size_t adcIndex = 0; adcIndex < calibration->channels.size(); adcIndex++) {
+        ChannelScale channel = calibration->scale((int)adcIndex);
+        double peak = channel.apply(features.channel[adcIndex].peak);
+        if (channel.photoelectrons) highest = std::max(highest, peak);
+        else highestADC = std::max(highestADC, peak);
+    }
+    scale.maximum = std::ceil(highest + 0.5);
+    scale.maximumADC = std::ceil((highestADC + 0.5) / 10) * 10;
+    return scale;
+}
+
+#endif
@@ -0,0 +1,272 @@
+// Detector geometry: the shape of the adcVal/area/baselineMean branches, the ADC channel each PMT and
+// SiPM is read out on, and where the channels are placed on the combined and PMT-only charts.
+// A geometry is selected by name (one of builtinGeometries) or read from a text file, e.g.
+//   # 4 PMTs on an 8-channel digitizer with 64 samples
+//   name = small
+//   channels = 8
+//   samples = 64
+//   pmt_channels = 0 1 2 3
+//   sipm_channels =
+//   combined_row = P1 P2
+//   combined_row = P3 P4
+//   pmt_row = P1 P2
+//   pmt_row = P3 P4
+// pmt_channels/sipm_channels list the ADC channel of PMT 1, 2, ... and SiPM 1, 2, ...; every *_row line adds a
+// row of pads to a chart, with Pn for PMT n, Sn for SiPM n and - for an empty pad.
+// Detector channels number the PMTs first (0 to nPMTs-1) and then the SiPMs.
+#ifndef DETECTORGEOMETRY_H
+#define DETECTORGEOMETRY_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include "Rtypes.h"
+
+struct DetectorGeometry {
+    std::string name;
+    int nChannels = 0; // Rows of adcVal, area and baselineMean
+    int nSamples = 0;  // Time bins per channel
+    std::vector<int> pmtChannels;  // PMT n (1-N) is read out on ADC channel pmtChannels[n-1]
+    std::vector<int> sipmChannels; // SiPM n (1-N) is read out on ADC channel sipmChannels[n-1]
+
+    // Pads of the charts, row by row: the detector channel shown on the pad or -1 for an empty pad
+    int combinedRows = 0, combinedCols = 0;
+    std::vector<int> combinedLayout;
+    int pmtRows = 0, pmtCols = 0;
+    std::vector<int> pmtLayout;
+
+    int nPMTs() const { return (int)pmtChannels.size(); }
+    int nSiPMs() const { return (int)sipmChannels.size(); }
+    int nDetectorChannels() const { return nPMTs() + nSiPMs(); }
+    bool isSiPM(int detectorChannel) const { return detectorChannel >= nPMTs(); }
+
+    // ADC channel (row of adcVal) of a detector channel
+    int adcChannel(int detectorChannel) const {
+        return isSiPM(detectorChannel) ? sipmChannels[detectorChannel - nPMTs()] : pmtChannels[detectorChannel];
+    }
+
+    // PMT or SiPM number (1-N) of a detector channel
+    int channelNumber(int detectorChannel) const {
+        return isSiPM(detectorChannel) ? detectorChannel - nPMTs() + 1 : detectorChannel + 1;
+    }
+
+    // "PMT n" or "SiPM n"
+    std::string channelName(int detectorChannel) const {
+        return (isSiPM(detectorChannel) ? "SiPM " : "PMT ") + std::to_string(channelNumber(detectorChannel));
+    }
+
+    // Time of the last sample in ns, the end of the plotted time axis (720 ns for 45 samples)
+    double timeWindow() const {
+        return nSamples * 16.0;
+    }
+
+    // Fingerprint of everything that decides which data an event index entry holds
+    uint32_t hash() const {
+        uint32_t h = 2166136261u; // FNV-1a
+        auto add = [&h](int value) {
+            for (int byte = 0; byte < 4; byte++) {
+                h = (h ^ ((uint32_t)value >> (8 * byte) & 0xFF)) * 16777619u;
+            }
+        };
+        add(nChannels);
+        add(nSamples);
+        add(nPMTs());
+        for (int channel : pmtChannels) add(channel);
+        add(nSiPMs());
+        for (int channel : sipmChannels) add(channel);
+        return h;
+    }
+};
+
+// Geometries that can be selected by name. "standard" is the detector the tools were written for:
+// 12 PMTs and 10 SiPMs on 23 channels of 45 samples.
+struct BuiltinGeometry {
+    const char *name;
+    const char *description;
+};
+
+const BuiltinGeometry builtinGeometries[] = {
+    {"standard",
+     "name = standard\n"
+     "channels = 23\n"
+     "samples = 45\n"
+     "pmt_channels = 0 10 7 2 6 3 8 9 11 4 5 1\n"
+     "sipm_channels = 12 13 14 15 16 17 18 19 20 21\n"
+     "combined_row = -  -   S9  S10 -\n"
+     "combined_row = S5 P10 P4  P8  S1\n"
+     "combined_row = S4 P6  P5  P9  -\n"
+     "combined_row = S8 P1  P7  P2  S6\n"
+     "combined_row = -  P11 P12 P3  S2\n"
+     "combined_row = -  S3  S7  -   -\n"
+     "pmt_row = P10 P4  P8\n"
+     "pmt_row = P6  P5  P9\n"
+     "pmt_row = P1  P7  P2\n"
+     "pmt_row = P11 P12 P3\n"},
+};
+
+const char *const defaultGeometryName = "standard";
+
+// Resolve one pad of a *_row line ("P3", "S10" or "-") to a detector channel
+inline bool parseGeometryPad(const std::string &word, const DetectorGeometry &geometry, int &detectorChannel) {
+    if (word == "-") {
+        detectorChannel = -1;
+        return true;
+    }
+    if (word.size() < 2 || (word[0] != 'P' && word[0] != 'S')) return false;
+    char *end = nullptr;
+    long number = strtol(word.c_str() + 1, &end, 10);
+    if (*end != '\0' || number < 1 || number > (word[0] == 'P' ? geometry.nPMTs() : geometry.nSiPMs())) return false;
+    detectorChannel = word[0] == 'P' ? (int)number - 1 : geometry.nPMTs() + (int)number - 1;
+    return true;
+}
+
+// Resolve the pads of the *_row lines of a chart once all channels are known
+inline bool parseGeometryRows(const std::vector<std::vector<std::string>> &rowWords, const DetectorGeometry &geometry,
+                              int &rows, int &cols, std::vector<int> &layout, std::string &error) {
+    rows = (int)rowWords.size();
+    cols = rowWords.empty() ? 0 : (int)rowWords[0].size();
+    layout.clear();
+    for (const std::vector<std::string> &words : rowWords) {
+        if ((int)words.size() != cols) {
+            error = "rows of a chart must have the same number of pads";
+            return false;
+        }
+        for (const std::string &word : words) {
+            int pad;
+            if (!parseGeometryPad(word, geometry, pad)) {
+                error = "unknown pad '" + word + "'";
+                return false;
+            }
+            layout.push_back(pad);
+        }
+    }
+    return true;
+}
+
+// Check that the channels and charts of a geometry are consistent
+inline bool validateGeometry(const DetectorGeometry &geometry, const std::string &source) {
+    std::string error;
+    if (geometry.nChannels < 1) error = "channels must be at least 1";
+    else if (geometry.nSamples < 8 || geometry.nSamples > 256) error = "samples must be between 8 and 256";
+    else if (geometry.nDetectorChannels() == 0) error = "no PMT or SiPM channels";
+    else if (geometry.combinedLayout.empty()) error = "no combined_row given";
+    std::vector<int> readOutBy(geometry.nChannels > 0 ? geometry.nChannels : 0, -1); // Detector channel of each ADC channel
+    for (int detectorChannel = 0; error.empty() && detectorChannel < geometry.nDetectorChannels(); detectorChannel++) {
+        int adcChannel = geometry.adcChannel(detectorChannel);
+        if (adcChannel < 0 || adcChannel >= geometry.nChannels) {
+            error = geometry.channelName(detectorChannel) + " is read out on channel " + std::to_string(adcChannel) +
+                    ", outside 0-" + std::to_string(geometry.nChannels - 1);
+        } else if (readOutBy[adcChannel] >= 0) {
+            error = geometry.channelName(readOutBy[adcChannel]) + " and " + geometry.channelName(detectorChannel) +
+                    " are both read out on channel " + std::to_string(adcChannel);
+        } else {
+            readOutBy[adcChannel] = detectorChannel;
+        }
+    }
+    for (int pad : geometry.pmtLayout) {
+        if (error.empty() && pad >= geometry.nPMTs()) error = "pmt_row may only show PMTs";
+    }
+
+    // Every channel is shown on at most one pad of a chart
+    for (const std::vector<int> *layout : {&geometry.combinedLayout, &geometry.pmtLayout}) {
+        std::vector<bool> shown(geometry.nDetectorChannels(), false);
+        for (int pad : *layout) {
+            if (!error.empty() || pad < 0) continue;
+            if (shown[pad]) error = geometry.channelName(pad) + " is on more than one pad of " + (layout == &geometry.pmtLayout ? "pmt_row" : "combined_row");
+            shown[pad] = true;
+        }
+    }
+    if (!error.empty()) {
+        std::cerr << "Error in detector geometry " << source << ": " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Parse the text of a geometry description
+inline bool parseGeometry(const std::string &text, const std::string &source, DetectorGeometry &geometry) {
+    geometry = DetectorGeometry();
+    std::vector<std::vector<std::string>> combinedRows, pmtRows;
+    std::istringstream lines(text);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(lines, line)) {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        size_t equals = line.find('=');
+        std::istringstream keyWords(line.substr(0, equals));
+        std::string key;
+        if (!(keyWords >> key)) continue; // Blank line
+
+        std::istringstream words(equals == std::string::npos ? "" : line.substr(equals + 1));
+        bool ok = equals != std::string::npos;
+        if (!ok) {
+            // Reported below
+        } else if (key == "name") {
+            ok = (bool)(words >> geometry.name);
+        } else if (key == "channels") {
+            ok = (bool)(words >> geometry.nChannels);
+        } else if (key == "samples") {
+            ok = (bool)(words >> geometry.nSamples);
+        } else if (key == "pmt_channels" || key == "sipm_channels") {
+            std::vector<int> &channels = key == "pmt_channels" ? geometry.pmtChannels : geometry.sipmChannels;
+            channels.clear();
+            int channel;
+            while (words >> channel) channels.push_back(channel);
+            ok = words.eof();
+        } else if (key == "combined_row" || key == "pmt_row") {
+            std::vector<std::string> row;
+            std::string word;
+            while (words >> word) row.push_back(word);
+            ok = !row.empty();
+            (key == "combined_row" ? combinedRows : pmtRows).push_back(row);
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Error in detector geometry " << source << " line " << lineNumber << ": " << line << std::endl;
+            return false;
+        }
+    }
+
+    std::string error;
+    if (!parseGeometryRows(combinedRows, geometry, geometry.combinedRows, geometry.combinedCols, geometry.combinedLayout, error) ||
+        !parseGeometryRows(pmtRows, geometry, geometry.pmtRows, geometry.pmtCols, geometry.pmtLayout, error)) {
+        std::cerr << "Error in detector geometry " << source << ": " << error << std::endl;
+        return false;
+    }
+    return validateGeometry(geometry, source);
+}
+
+// Select a geometry by builtin name or read it from a file
+inline bool loadDetectorGeometry(const char *spec, DetectorGeometry &geometry) {
+    for (const BuiltinGeometry &builtin : builtinGeometries) {
+        if (std::string(spec) == builtin.name) return parseGeometry(builtin.description, builtin.name, geometry);
+    }
+    std::ifstream in(spec);
+    if (!in) {
+        std::cerr << "Error: unknown detector geometry '" << spec << "' (builtin:";
+        for (const BuiltinGeometry &builtin : builtinGeometries) std::cerr << " " << builtin.name;
+        std::cerr << ")" << std::endl;
+        return false;
+    }
+    std::ostringstream text;
+    text << in.rdbuf();
+    if (!parseGeometry(text.str(), spec, geometry)) return false;
+    if (geometry.name.empty()) geometry.name = spec;
+    return true;
+}
+
+// The standard geometry, used when no --geometry is given
+inline DetectorGeometry defaultGeometry() {
+    DetectorGeometry geometry;
+    loadDetectorGeometry(defaultGeometryName, geometry);
+    return geometry;
+}
+
+#endif
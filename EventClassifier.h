@@ -0,0 +1,228 @@
+// Classification of the events of a run by named rules (--classify <rules file>). Every line of the rules file
+// names a class and gives its predicate (EventPredicate.h), e.g.
+//   # Class: predicate
+//   muon:      6 of PMT peak > 400 within 3 && all of SiPM 1,2 peak > 300 within 2
+//   sipm_pair: all of SiPM 1-2 peak > 300 within 2 window 10 to 25
+//   quiet:     max peak < 100
+// The classes are evaluated independently, so an event can belong to several of them (or to none).
+// The rules only read the event index: the run is classified file by file, the events of each file split into
+// contiguous blocks per worker whose lists are concatenated in event order. The list of every class is written in
+// the event list syntax (EventList.h) to <output>/Classes_<run>/<class>.txt, so it can be passed back as @file,
+// and --class <name> plots the events of one class directly.
+#ifndef EVENTCLASSIFIER_H
+#define EVENTCLASSIFIER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <algorithm>
+#include <TStopwatch.h>
+#include "DetectorGeometry.h"
+#include "RunFiles.h"
+#include "EventIndex.h"
+#include "EventPredicate.h"
+#include "OutputLayout.h"
+#include "WorkerPool.h"
+
+struct EventClass {
+    std::string name;
+    std::string rule;
+    EventPredicate predicate;
+    std::vector<Long64_t> events; // Run-global EventIDs of the class, ascending
+};
+
+struct EventClassifier {
+    std::vector<EventClass> classes;
+    Long64_t nEvents = 0;       // Events classified
+    Long64_t nUnclassified = 0; // Events in no class
+
+    // Read "name: predicate" lines; '#' starts a comment. Names are used as file names, so only letters, digits, '_' and '-'.
+    bool readRules(const char *fileName, const DetectorGeometry &geometry) {
+        std::ifstream in(fileName);
+        if (!in) {
+            std::cerr << "Error opening classification rules: " << fileName << std::endl;
+            return false;
+        }
+        classes.clear();
+        std::string line;
+        for (int lineNumber = 1; std::getline(in, line); lineNumber++) {
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            size_t colon = line.find(':');
+            EventClass eventClass;
+            if (colon != std::string::npos) {
+                eventClass.name = trim(line.substr(0, colon));
+                eventClass.rule = trim(line.substr(colon + 1));
+            }
+            if (!validName(eventClass.name) || eventClass.rule.empty()) {
+                std::cerr << "Error: " << fileName << ":" << lineNumber << ": expected 'name: predicate'" << std::endl;
+                return false;
+            }
+            if (find(eventClass.name) >= 0) {
+                std::cerr << "Error: " << fileName << ":" << lineNumber << ": class '" << eventClass.name << "' is defined twice" << std::endl;
+                return false;
+            }
+            if (!eventClass.predicate.parse(eventClass.rule.c_str(), geometry)) return false;
+            classes.push_back(eventClass);
+        }
+        if (classes.empty()) {
+            std::cerr << "Error: no classes defined in " << fileName << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Index of the class with this name, -1 if there is none
+    int find(const std::string &name) const {
+        for (size_t i = 0; i < classes.size(); i++) {
+            if (classes[i].name == name) return (int)i;
+        }
+        return -1;
+    }
+
+    // Classify the events of the index of one file, whose first event has the run-global EventID firstEvent
+    void classify(const EventIndex &index, Long64_t firstEvent, int nWorkers) {
+        Long64_t n = index.nEvents;
+        if (nWorkers < 1) nWorkers = defaultWorkerCount();
+        if (nWorkers > n) nWorkers = n > 0 ? (int)n : 1;
+
+        // Per worker: the lists of every class for its block, and the events of the block in no class
+        std::vector<std::vector<std::vector<Long64_t>>> parts(nWorkers, std::vector<std::vector<Long64_t>>(classes.size()));
+        std::vector<Long64_t> unclassified(nWorkers, 0);
+        runWorkers(nWorkers, [&](int worker) {
+            Long64_t first = n * worker / nWorkers;
+            Long64_t last = n * (worker + 1) / nWorkers - 1;
+            for (Long64_t EventID = first; EventID <= last; EventID++) {
+                bool any = false;
+                for (size_t c = 0; c < classes.size(); c++) {
+                    if (classes[c].predicate.matches(index, EventID)) {
+                        parts[worker][c].push_back(firstEvent + EventID);
+                        any = true;
+                    }
+                }
+                if (!any) unclassified[worker]++;
+            }
+        });
+
+        for (int worker = 0; worker < nWorkers; worker++) {
+            for (size_t c = 0; c < classes.size(); c++) {
+                classes[c].events.insert(classes[c].events.end(), parts[worker][c].begin(), parts[worker][c].end());
+            }
+            nUnclassified += unclassified[worker];
+        }
+        nEvents += n;
+    }
+
+    // Classify a whole run, one file index in memory at a time
+    bool classifyRun(const RunFiles &run, const DetectorGeometry &geometry, int nWorkers) {
+        for (EventClass &eventClass : classes) eventClass.events.clear();
+        nEvents = nUnclassified = 0;
+        for (int file = 0; file < run.nFiles(); file++) {
+            EventIndex index;
+            if (!loadEventIndex(run.fileNames[file].c_str(), geometry, index, nWorkers, false)) return false;
+            if (index.nEvents != run.fileEntries(file)) {
+                std::cerr << "Error: event index of " << run.fileNames[file] << " doesn't match the file" << std::endl;
+                return false;
+            }
+            classify(index, run.firstEntry[file], nWorkers);
+        }
+        return true;
+    }
+
+    // Write the list of every class to <directory>/<class>.txt
+    bool writeLists(const std::string &directory, const std::string &runLabel) const {
+        if (!makeDirectories(directory)) return false;
+        for (const EventClass &eventClass : classes) {
+            std::string fileName = directory + "/" + eventClass.name + ".txt";
+            std::string temporaryName = temporaryFileName(fileName);
+            std::ofstream out(temporaryName);
+            out << "# Class " << eventClass.name << " of " << runLabel << ": " << eventClass.rule << std::endl
+                << "# " << eventClass.events.size() << " of " << nEvents << " events" << std::endl;
+            writeEventRanges(out, eventClass.events);
+            out.close();
+            if (!out) {
+                std::cerr << "Error writing event list: " << fileName << std::endl;
+                unlink(temporaryName.c_str());
+                return false;
+            }
+            if (!commitFile(temporaryName, fileName)) return false;
+        }
+        return true;
+    }
+
+private:
+    static std::string trim(const std::string &text) {
+        size_t first = text.find_first_not_of(" \t\r");
+        if (first == std::string::npos) return "";
+        return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+    }
+
+    static bool validName(const std::string &name) {
+        if (name.empty()) return false;
+        for (char c : name) {
+            if (!isalnum((unsigned char)c) && c != '_' && c != '-') return false;
+        }
+        return true;
+    }
+
+    // Ascending EventIDs as ranges of consecutive IDs, a few per line
+    static void writeEventRanges(std::ostream &out, const std::vector<Long64_t> &events) {
+        int onLine = 0;
+        for (size_t i = 0; i < events.size();) {
+            size_t j = i;
+            while (j + 1 < events.size() && events[j + 1] == events[j] + 1) j++;
+            out << (onLine > 0 ? "," : "") << events[i];
+            if (j > i) out << "-" << events[j];
+            if (++onLine == 16) {
+                out << std::endl;
+                onLine = 0;
+            }
+            i = j + 1;
+        }
+        if (onLine > 0) out << std::endl;
+    }
+};
+
+// Classify the run by the rules file, print the counts per class and write the class lists. With className, the
+// events are narrowed down to that class; otherwise they are left alone.
+inline bool applyClassification(const RunFiles &run, const DetectorGeometry &geometry, const OutputLayout &layout, const char *rulesFileName,
+                                const char *className, int nWorkers, std::vector<Long64_t> &events) {
+    EventClassifier classifier;
+    if (!classifier.readRules(rulesFileName, geometry)) return false;
+    int selected = className ? classifier.find(className) : -1;
+    if (className && selected < 0) {
+        std::cerr << "Error: class '" << className << "' is not defined in " << rulesFileName << std::endl;
+        return false;
+    }
+
+    TStopwatch timer;
+    if (!classifier.classifyRun(run, geometry, nWorkers)) return false;
+    timer.Stop();
+    double seconds = timer.RealTime();
+    std::cout << "Classified " << classifier.nEvents << " events in " << seconds * 1000 << " ms ("
+              << (seconds > 0 ? classifier.nEvents / seconds : 0) << " events/s)" << std::endl;
+    for (const EventClass &eventClass : classifier.classes) {
+        std::cout << "  " << eventClass.name << ": " << eventClass.events.size() << " ("
+                  << (classifier.nEvents > 0 ? 100.0 * eventClass.events.size() / classifier.nEvents : 0) << "%)" << std::endl;
+    }
+    std::cout << "  unclassified: " << classifier.nUnclassified << std::endl;
+
+    std::string directory = layout.path("Classes_" + layout.runName);
+    if (!classifier.writeLists(directory, run.label())) return false;
+    std::cout << "Class event lists saved in " << directory << std::endl;
+
+    if (selected >= 0) {
+        const std::vector<Long64_t> &members = classifier.classes[selected].events;
+        size_t kept = 0;
+        for (Long64_t EventID : events) {
+            if (std::binary_search(members.begin(), members.end(), EventID)) events[kept++] = EventID;
+        }
+        events.resize(kept);
+        std::cout << "Class " << className << ": " << events.size() << " events to plot" << std::endl;
+    }
+    return true;
+}
+
+#endif
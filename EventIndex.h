@@ -0,0 +1,227 @@
+// Per-event summary index stored in a sidecar file next to the ROOT file (<file>.widx).
+// For every PMT and SiPM of the detector geometry (index channel = detector channel), the index holds
+// area, baselineMean, peak adcVal and the sample of the peak. The data is stored column by column
+// ([field][channel][event]), so selecting events only streams the columns a predicate uses.
+// The index is written under a temporary name and renamed when complete, so a reader never sees a partial one.
+#ifndef EVENTINDEX_H
+#define EVENTINDEX_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+#include <sys/stat.h>
+#include "DetectorGeometry.h"
+#include "RunFiles.h"
+#include "WaveformReader.h"
+#include "WorkerPool.h"
+#include "WaveformFeatures.h"
+
+// Header of the sidecar file. The size and modification time of the ROOT file it was built from
+// and the hash of the detector geometry are kept so that a stale index is detected and rebuilt.
+struct EventIndexHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t nChannels;
+    uint32_t geometryHash;
+    int64_t nEvents;
+    int64_t sourceSize;
+    int64_t sourceMTime;
+};
+
+const uint32_t eventIndexVersion = 2;
+
+struct EventIndex {
+    Long64_t nEvents = 0;
+    int nChannels = 0; // Detector channels: PMTs first, then SiPMs
+
+    // Columns, element [channel * nEvents + event]
+    std::vector<float> area;
+    std::vector<float> baselineMean;
+    std::vector<Short_t> peakADC;
+    std::vector<uint8_t> peakSample;
+
+    void resize(Long64_t n, int channels) {
+        nEvents = n;
+        nChannels = channels;
+        area.assign(nChannels * n, 0);
+        baselineMean.assign(nChannels * n, 0);
+        peakADC.assign(nChannels * n, 0);
+        peakSample.assign(nChannels * n, 0);
+    }
+
+    // Copy the records of the index of one file of a run to its run-global EventIDs, starting at firstEvent
+    void place(const EventIndex &part, Long64_t firstEvent) {
+        for (int channel = 0; channel < nChannels; channel++) {
+            Long64_t from = channel * part.nEvents, to = channel * nEvents + firstEvent;
+            std::copy(part.area.begin() + from, part.area.begin() + from + part.nEvents, area.begin() + to);
+            std::copy(part.baselineMean.begin() + from, part.baselineMean.begin() + from + part.nEvents, baselineMean.begin() + to);
+            std::copy(part.peakADC.begin() + from, part.peakADC.begin() + from + part.nEvents, peakADC.begin() + to);
+            std::copy(part.peakSample.begin() + from, part.peakSample.begin() + from + part.nEvents, peakSample.begin() + to);
+        }
+    }
+
+    // Store the index record of the event loaded in reader; features is scratch space reused between events
+    void fill(Long64_t EventID, const WaveformReader &reader, const DetectorGeometry &geometry, EventFeatures &features) {
+        reader.extractFeatures(features);
+        for (int channel = 0; channel < nChannels; channel++) {
+            int adcIndex = geometry.adcChannel(channel);
+            Long64_t i = channel * nEvents + EventID;
+            area[i] = reader.area[adcIndex];
+            baselineMean[i] = reader.baselineMean[adcIndex];
+            peakADC[i] = features.channel[adcIndex].peak;
+            peakSample[i] = features.channel[adcIndex].peakSample;
+        }
+    }
+
+    // Build the index with one pass over the tree, splitting the entries into contiguous blocks per worker
+    bool build(const char *fileName, const DetectorGeometry &geometry, int nWorkers) {
+        Long64_t n = 0;
+        {
+            WaveformReader reader;
+            if (!reader.open(fileName, geometry)) return false;
+            n = reader.nEntries;
+        }
+        resize(n, geometry.nDetectorChannels());
+
+        if (nWorkers < 1) nWorkers = defaultWorkerCount();
+        if (nWorkers > n) nWorkers = n > 0 ? (int)n : 1;
+
+        std::atomic<bool> ok(true);
+        runWorkers(nWorkers, [&](int worker) {
+            Long64_t first = n * worker / nWorkers;
+            Long64_t last = n * (worker + 1) / nWorkers - 1;
+            WaveformReader reader;
+            if (!reader.open(fileName, geometry)) {
+                ok = false;
+                return;
+            }
+            reader.setEntryRange(first, last);
+            EventFeatures features;
+            for (Long64_t EventID = first; EventID <= last; EventID++) {
+                if (!reader.load(EventID)) {
+                    ok = false;
+                    return;
+                }
+                fill(EventID, reader, geometry, features);
+            }
+        });
+        return ok;
+    }
+
+    bool write(const std::string &indexFileName, const struct stat &source, const DetectorGeometry &geometry) const {
+        std::string partialFileName = indexFileName + ".partial";
+        std::ofstream out(partialFileName, std::ios::binary);
+        if (!out) {
+            std::cerr << "Error writing event index: " << indexFileName << std::endl;
+            return false;
+        }
+        EventIndexHeader header;
+        memcpy(header.magic, "WIDX", 4);
+        header.version = eventIndexVersion;
+        header.nChannels = nChannels;
+        header.geometryHash = geometry.hash();
+        header.nEvents = nEvents;
+        header.sourceSize = source.st_size;
+        header.sourceMTime = source.st_mtime;
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)area.data(), area.size() * sizeof(float));
+        out.write((const char*)baselineMean.data(), baselineMean.size() * sizeof(float));
+        out.write((const char*)peakADC.data(), peakADC.size() * sizeof(Short_t));
+        out.write((const char*)peakSample.data(), peakSample.size() * sizeof(uint8_t));
+        out.close();
+        if (!out || rename(partialFileName.c_str(), indexFileName.c_str()) != 0) {
+            std::cerr << "Error writing event index: " << indexFileName << std::endl;
+            remove(partialFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Read the index; fails quietly if it is missing, has another format, is older than the ROOT file,
+    // was built for another geometry or its size doesn't match its header
+    bool read(const std::string &indexFileName, const struct stat &source, const DetectorGeometry &geometry) {
+        std::ifstream in(indexFileName, std::ios::binary);
+        struct stat index;
+        if (!in || stat(indexFileName.c_str(), &index) != 0) return false;
+        EventIndexHeader header;
+        if (!in.read((char*)&header, sizeof(header))) return false;
+        if (memcmp(header.magic, "WIDX", 4) != 0 || header.version != eventIndexVersion ||
+            header.nChannels != (uint32_t)geometry.nDetectorChannels() || header.geometryHash != geometry.hash() ||
+            header.sourceSize != (int64_t)source.st_size ||
+            header.sourceMTime != (int64_t)source.st_mtime) {
+            return false;
+        }
+
+        // Check the event count against the file size before allocating for it, so a truncated or corrupt index is rebuilt
+        int64_t recordBytes = header.nChannels * (int64_t)(2 * sizeof(float) + sizeof(Short_t) + sizeof(uint8_t));
+        int64_t size = (int64_t)index.st_size - (int64_t)sizeof(header);
+        if (header.nEvents < 0 || recordBytes == 0 || header.nEvents > size / recordBytes || header.nEvents * recordBytes != size) return false;
+        resize(header.nEvents, header.nChannels);
+        in.read((char*)area.data(), area.size() * sizeof(float));
+        in.read((char*)baselineMean.data(), baselineMean.size() * sizeof(float));
+        in.read((char*)peakADC.data(), peakADC.size() * sizeof(Short_t));
+        in.read((char*)peakSample.data(), peakSample.size() * sizeof(uint8_t));
+        return (bool)in;
+    }
+};
+
+inline std::string eventIndexFileName(const char *fileName) {
+    return std::string(fileName) + ".widx";
+}
+
+// Load the sidecar index of fileName, building (and saving) it first if it is missing, stale or rebuild is set
+inline bool loadEventIndex(const char *fileName, const DetectorGeometry &geometry, EventIndex &index, int nWorkers, bool rebuild) {
+    struct stat source;
+    if (stat(fileName, &source) != 0) {
+        std::cerr << "Error opening file: " << fileName << std::endl;
+        return false;
+    }
+
+    std::string indexFileName = eventIndexFileName(fileName);
+    if (!rebuild && index.read(indexFileName, source, geometry)) return true;
+
+    {
+        std::lock_guard<std::mutex> lock(consoleMutex());
+        std::cout << "Building event index " << indexFileName << std::endl;
+    }
+    if (!index.build(fileName, geometry, nWorkers)) return false;
+    index.write(indexFileName, source, geometry); // The index is still usable in memory if the sidecar can't be written
+    return true;
+}
+
+// Load the index of a whole run. Every file keeps its own sidecar; the files are indexed in parallel, one worker
+// per file (a single file is split over the workers instead), and the parts are placed at their run-global EventIDs.
+inline bool loadRunIndex(const RunFiles &run, const DetectorGeometry &geometry, EventIndex &index, int nWorkers, bool rebuild) {
+    if (run.nFiles() == 1) return loadEventIndex(run.fileNames[0].c_str(), geometry, index, nWorkers, rebuild);
+
+    int nFiles = run.nFiles();
+    std::vector<EventIndex> parts(nFiles);
+    if (nWorkers < 1) nWorkers = defaultWorkerCount();
+    if (nWorkers > nFiles) nWorkers = nFiles;
+    std::atomic<int> nextFile(0);
+    std::atomic<bool> ok(true);
+    runWorkers(nWorkers, [&](int) {
+        for (int file = nextFile++; file < nFiles; file = nextFile++) {
+            if (!loadEventIndex(run.fileNames[file].c_str(), geometry, parts[file], 1, rebuild)) ok = false;
+        }
+    });
+    if (!ok) return false;
+
+    index.resize(run.nEntries(), geometry.nDetectorChannels());
+    for (int file = 0; file < nFiles; file++) {
+        if (parts[file].nEvents != run.fileEntries(file)) {
+            std::cerr << "Error: event index of " << run.fileNames[file] << " doesn't match the file" << std::endl;
+            return false;
+        }
+        index.place(parts[file], run.firstEntry[file]);
+    }
+    return true;
+}
+
+#endif
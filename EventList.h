@@ -0,0 +1,101 @@
+// Parsing of event selections given on the command line.
+// An event selection is a comma separated list of single IDs and inclusive ranges
+// (e.g. "42", "0-5000", "1,5,9-12"), or "@file" to read the same syntax from a text file
+// with one or more entries per line and '#' comments.
+#ifndef EVENTLIST_H
+#define EVENTLIST_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cctype>
+#include "Rtypes.h"
+
+// Parse a single token ("42" or "10-20") and append the IDs to events
+inline bool parseEventToken(const std::string &token, Long64_t nEntries, std::vector<Long64_t> &events) {
+    if (token.empty()) return true;
+
+    const char *text = token.c_str();
+    char *end = nullptr;
+    Long64_t first = strtoll(text, &end, 10);
+    if (end == text) {
+        std::cerr << "Error: invalid event selection '" << token << "'" << std::endl;
+        return false;
+    }
+
+    Long64_t last = first;
+    if (*end == '-') {
+        const char *rangeEnd = end + 1;
+        last = strtoll(rangeEnd, &end, 10);
+        if (end == rangeEnd) {
+            std::cerr << "Error: invalid event range '" << token << "'" << std::endl;
+            return false;
+        }
+    }
+    if (*end != '\0') {
+        std::cerr << "Error: invalid event selection '" << token << "'" << std::endl;
+        return false;
+    }
+    if (last < first) {
+        std::cerr << "Error: event range '" << token << "' is reversed" << std::endl;
+        return false;
+    }
+    if (first < 0 || last >= nEntries) {
+        std::cerr << "Error: EventID " << (first < 0 ? first : last) << " is out of range (0-" << nEntries-1 << ")" << std::endl;
+        return false;
+    }
+
+    for (Long64_t id = first; id <= last; id++) {
+        events.push_back(id);
+    }
+    return true;
+}
+
+// Parse a comma/whitespace separated list of tokens
+inline bool parseEventTokens(const std::string &text, Long64_t nEntries, std::vector<Long64_t> &events) {
+    std::string token;
+    for (char c : text) {
+        if (c == ',' || isspace((unsigned char)c)) {
+            if (!parseEventToken(token, nEntries, events)) return false;
+            token.clear();
+        } else {
+            token += c;
+        }
+    }
+    return parseEventToken(token, nEntries, events);
+}
+
+// Resolve an event selection against a tree with nEntries entries
+inline bool parseEventList(const char *spec, Long64_t nEntries, std::vector<Long64_t> &events) {
+    events.clear();
+    if (!spec || !*spec) {
+        std::cerr << "Error: empty event selection" << std::endl;
+        return false;
+    }
+
+    if (spec[0] != '@') {
+        if (!parseEventTokens(spec, nEntries, events)) return false;
+    } else {
+        std::ifstream listFile(spec + 1);
+        if (!listFile) {
+            std::cerr << "Error opening event list: " << spec + 1 << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(listFile, line)) {
+            line = line.substr(0, line.find('#')); // Strip comments
+            if (!parseEventTokens(line, nEntries, events)) return false;
+        }
+    }
+
+    if (events.empty()) {
+        std::cerr << "Error: event selection '" << spec << "' is empty" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+#endif
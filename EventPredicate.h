@@ -0,0 +1,326 @@
+// Event selection predicates evaluated against the EventIndex, e.g.
+//   "total PMT area > 5000"
+//   "SiPM 3 peak > 400 && PMT5 time < 200"
+//   "area[PMT5] > 100 || max SiPM peak >= 1000"
+//   "3 of PMT peak > 400 within 2 && all of SiPM 1,2 peak > 300"
+// A condition names an optional aggregate (total/sum, max, min), a channel group (PMT, SiPM or
+// nothing for all channels) with optional channel numbers and ranges ("PMT 1-6", "SiPM 1,2"), and a field:
+// area, bm (baselineMean), peak (peak adcVal), time (peak time in ns) or sample (peak sample). Multi-channel
+// conditions default to the total for area and to the maximum for the other fields.
+// Coincidences count channels instead: "<N> of" (or "all of") the channels must pass the comparison on their own,
+// and with "within <W>" their peak samples must lie no more than W samples apart. "window <first> to <last>"
+// only lets channels peaking in those samples take part, in coincidences and aggregates alike.
+// Conditions are combined with && / and, || / or; && binds tighter than ||.
+#ifndef EVENTPREDICATE_H
+#define EVENTPREDICATE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <TStopwatch.h>
+#include "EventIndex.h"
+
+const int maxCoincidenceChannels = 256;
+
+struct EventCondition {
+    enum Field { kArea, kBaseline, kPeak, kPeakTime, kPeakSample };
+    enum Aggregate { kDefault, kTotal, kMax, kMin };
+    enum Comparison { kGreater, kGreaterEqual, kLess, kLessEqual, kEqual, kNotEqual };
+
+    Field field = kArea;
+    Aggregate aggregate = kDefault;
+    std::vector<int> channels; // Detector channels the condition looks at (PMTs first, then SiPMs)
+    Comparison comparison = kGreater;
+    double value = 0;
+    int minCount = 0;                   // Coincidence of at least minCount channels, 0 to compare the aggregate
+    int window = -1;                    // Largest spread of the coincident peak samples, -1 for any
+    int firstSample = 0, lastSample = 255; // Peak samples of the channels taking part
+
+    double channelValue(const EventIndex &index, int channel, Long64_t EventID) const {
+        Long64_t i = channel * index.nEvents + EventID;
+        switch (field) {
+            case kArea: return index.area[i];
+            case kBaseline: return index.baselineMean[i];
+            case kPeak: return index.peakADC[i];
+            case kPeakTime: return sampleTime(index.peakSample[i]);
+            case kPeakSample: return index.peakSample[i];
+        }
+        return 0;
+    }
+
+    bool compare(double q) const {
+        switch (comparison) {
+            case kGreater: return q > value;
+            case kGreaterEqual: return q >= value;
+            case kLess: return q < value;
+            case kLessEqual: return q <= value;
+            case kEqual: return q == value;
+            case kNotEqual: return q != value;
+        }
+        return false;
+    }
+
+    bool inWindow(const EventIndex &index, int channel, Long64_t EventID) const {
+        int sample = index.peakSample[channel * index.nEvents + EventID];
+        return sample >= firstSample && sample <= lastSample;
+    }
+
+    bool matches(const EventIndex &index, Long64_t EventID) const {
+        if (minCount > 0) return coincident(index, EventID);
+        bool any = false;
+        double result = 0;
+        for (int channel : channels) {
+            if (!inWindow(index, channel, EventID)) continue;
+            double v = channelValue(index, channel, EventID);
+            if (!any) result = v;
+            else if (aggregate == kTotal) result += v;
+            else if (aggregate == kMin) result = std::min(result, v);
+            else result = std::max(result, v);
+            any = true;
+        }
+        return any && compare(result);
+    }
+
+    // At least minCount channels pass, with their peak samples (sorted) spanning no more than window
+    bool coincident(const EventIndex &index, Long64_t EventID) const {
+        uint8_t peaks[maxCoincidenceChannels];
+        int n = 0;
+        for (int channel : channels) {
+            if (inWindow(index, channel, EventID) && compare(channelValue(index, channel, EventID))) {
+                uint8_t peak = index.peakSample[channel * index.nEvents + EventID];
+                int k = n++;
+                for (; k > 0 && peaks[k - 1] > peak; k--) peaks[k] = peaks[k - 1];
+                peaks[k] = peak;
+            }
+        }
+        if (n < minCount) return false;
+        if (window < 0) return true;
+        for (int first = 0, last = minCount - 1; last < n; first++, last++) {
+            if (peaks[last] - peaks[first] <= window) return true;
+        }
+        return false;
+    }
+};
+
+struct EventPredicate {
+    // Alternatives (||) of conjunctions (&&) of conditions
+    std::vector<std::vector<EventCondition>> anyOf;
+
+    bool matches(const EventIndex &index, Long64_t EventID) const {
+        for (const std::vector<EventCondition> &allOf : anyOf) {
+            bool all = true;
+            for (const EventCondition &condition : allOf) {
+                if (!condition.matches(index, EventID)) {
+                    all = false;
+                    break;
+                }
+            }
+            if (all) return true;
+        }
+        return false;
+    }
+
+    bool parse(const char *text, const DetectorGeometry &geometry) {
+        anyOf.assign(1, std::vector<EventCondition>());
+        std::vector<std::string> tokens;
+        if (!tokenize(text, tokens)) return fail(text, "unexpected character");
+
+        std::vector<std::string> condition;
+        for (size_t i = 0; i <= tokens.size(); i++) {
+            bool end = i == tokens.size();
+            bool isAnd = !end && (tokens[i] == "&&" || tokens[i] == "and");
+            bool isOr = !end && (tokens[i] == "||" || tokens[i] == "or");
+            if (!end && !isAnd && !isOr) {
+                condition.push_back(tokens[i]);
+                continue;
+            }
+            EventCondition parsed;
+            if (!parseCondition(condition, geometry, parsed)) return fail(text, "invalid condition");
+            anyOf.back().push_back(parsed);
+            condition.clear();
+            if (isOr) anyOf.push_back(std::vector<EventCondition>());
+        }
+        return true;
+    }
+
+private:
+    static bool fail(const char *text, const char *reason) {
+        std::cerr << "Error: can't parse selection '" << text << "': " << reason << std::endl;
+        return false;
+    }
+
+    // Split into lower-case words, numbers, comparison and logical operators and the '-' of ranges; brackets and
+    // commas are dropped. A '-' right after a number is a range, otherwise it starts a negative number.
+    static bool tokenize(const char *text, std::vector<std::string> &tokens) {
+        const char *p = text;
+        while (*p) {
+            bool afterNumber = !tokens.empty() && isNumber(tokens.back());
+            if (isspace((unsigned char)*p) || *p == '[' || *p == ']' || *p == '(' || *p == ')' || *p == ',') {
+                p++;
+            } else if (isalpha((unsigned char)*p) || *p == '_') {
+                std::string word;
+                while (isalpha((unsigned char)*p) || *p == '_') word += tolower((unsigned char)*p++);
+                tokens.push_back(word);
+            } else if (*p == '-' && afterNumber) {
+                tokens.push_back("-");
+                p++;
+            } else if (isdigit((unsigned char)*p) || *p == '.' || (*p == '-' && isdigit((unsigned char)p[1]))) {
+                char *end = nullptr;
+                strtod(p, &end);
+                tokens.push_back(std::string(p, end - p));
+                p = end;
+            } else if ((p[0] == '&' && p[1] == '&') || (p[0] == '|' && p[1] == '|') ||
+                       (p[1] == '=' && (p[0] == '>' || p[0] == '<' || p[0] == '=' || p[0] == '!'))) {
+                tokens.push_back(std::string(p, 2));
+                p += 2;
+            } else if (*p == '>' || *p == '<') {
+                tokens.push_back(std::string(p, 1));
+                p++;
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static bool isNumber(const std::string &token) {
+        return !token.empty() && (isdigit((unsigned char)token[0]) || token[0] == '.' || (token[0] == '-' && token.size() > 1));
+    }
+
+    static bool parseComparison(const std::string &op, EventCondition::Comparison &comparison) {
+        if (op == ">") comparison = EventCondition::kGreater;
+        else if (op == ">=") comparison = EventCondition::kGreaterEqual;
+        else if (op == "<") comparison = EventCondition::kLess;
+        else if (op == "<=") comparison = EventCondition::kLessEqual;
+        else if (op == "==") comparison = EventCondition::kEqual;
+        else if (op == "!=") comparison = EventCondition::kNotEqual;
+        else return false;
+        return true;
+    }
+
+    // Take the coincidence and window modifiers out of the tokens: "<N> of", "all of", "within <W> [samples]"
+    // and "window <first> to|- <last> [samples]". allOf is set for "all of".
+    static bool parseModifiers(std::vector<std::string> &tokens, EventCondition &condition, bool &allOf) {
+        std::vector<std::string> rest;
+        for (size_t i = 0; i < tokens.size(); i++) {
+            const std::string &t = tokens[i];
+            bool next = i + 1 < tokens.size();
+            if (next && tokens[i + 1] == "of" && (t == "all" || isNumber(t))) {
+                allOf = t == "all";
+                condition.minCount = allOf ? 0 : atoi(t.c_str());
+                if (!allOf && condition.minCount < 1) return false;
+                i++;
+            } else if (t == "within") {
+                if (!next || !isNumber(tokens[i + 1])) return false;
+                condition.window = atoi(tokens[++i].c_str());
+                if (condition.window < 0) return false;
+                if (i + 1 < tokens.size() && tokens[i + 1] == "samples") i++;
+            } else if (t == "window") {
+                if (i + 3 >= tokens.size() || !isNumber(tokens[i + 1]) || (tokens[i + 2] != "to" && tokens[i + 2] != "-") ||
+                    !isNumber(tokens[i + 3])) {
+                    return false;
+                }
+                condition.firstSample = atoi(tokens[i + 1].c_str());
+                condition.lastSample = atoi(tokens[i + 3].c_str());
+                if (condition.firstSample < 0 || condition.lastSample < condition.firstSample) return false;
+                i += 3;
+                if (i + 1 < tokens.size() && tokens[i + 1] == "samples") i++;
+            } else {
+                rest.push_back(t);
+            }
+        }
+        tokens.swap(rest);
+        return true;
+    }
+
+    static bool parseCondition(std::vector<std::string> tokens, const DetectorGeometry &geometry, EventCondition &condition) {
+        bool allOf = false;
+        if (!parseModifiers(tokens, condition, allOf)) return false;
+        if (condition.window >= 0 && condition.minCount == 0 && !allOf) return false; // "within" needs a coincidence
+
+        // "<quantity words> <op> <number>"
+        if (tokens.size() < 3) return false;
+        if (!parseComparison(tokens[tokens.size() - 2], condition.comparison)) return false;
+        if (!isNumber(tokens.back())) return false;
+        condition.value = atof(tokens.back().c_str());
+
+        bool haveField = false;
+        int group = -1; // 0 PMT, 1 SiPM
+        std::vector<int> channelNumbers; // None given
+        for (size_t i = 0; i + 2 < tokens.size(); i++) {
+            const std::string &t = tokens[i];
+            if (t == "total" || t == "sum") condition.aggregate = EventCondition::kTotal;
+            else if (t == "max") condition.aggregate = EventCondition::kMax;
+            else if (t == "min") condition.aggregate = EventCondition::kMin;
+            else if (t == "pmt" || t == "pmts") group = 0;
+            else if (t == "sipm" || t == "sipms") group = 1;
+            else if (isNumber(t) && group >= 0) channelNumbers.push_back(atoi(t.c_str()));
+            else if (t == "-" && !channelNumbers.empty() && i + 3 < tokens.size() && isNumber(tokens[i + 1])) {
+                // Range of channel numbers
+                int last = atoi(tokens[++i].c_str());
+                for (int number = channelNumbers.back() + 1; number <= last; number++) channelNumbers.push_back(number);
+            }
+            else if (t == "area") { condition.field = EventCondition::kArea; haveField = true; }
+            else if (t == "bm" || t == "baseline" || t == "baselinemean") { condition.field = EventCondition::kBaseline; haveField = true; }
+            else if (t == "peak" || t == "adc" || t == "adcval" || t == "amplitude") { condition.field = EventCondition::kPeak; haveField = true; }
+            else if (t == "time" || t == "peaktime") { condition.field = EventCondition::kPeakTime; haveField = true; }
+            else if (t == "sample" || t == "peaksample") { condition.field = EventCondition::kPeakSample; haveField = true; }
+            else return false;
+        }
+        if (!haveField) return false;
+
+        int firstChannel = group == 1 ? geometry.nPMTs() : 0;
+        int lastChannel = group == 0 ? geometry.nPMTs() - 1 : geometry.nDetectorChannels() - 1;
+        if (lastChannel < firstChannel) return false; // No channels of the group
+        condition.channels.clear();
+        if (channelNumbers.empty()) {
+            for (int channel = firstChannel; channel <= lastChannel; channel++) condition.channels.push_back(channel);
+        }
+        for (int number : channelNumbers) {
+            if (number < 1 || number > lastChannel - firstChannel + 1) return false;
+            int channel = firstChannel + number - 1;
+            if (std::find(condition.channels.begin(), condition.channels.end(), channel) == condition.channels.end()) {
+                condition.channels.push_back(channel);
+            }
+        }
+        if (condition.channels.size() > (size_t)maxCoincidenceChannels) return false;
+        if (allOf) condition.minCount = (int)condition.channels.size();
+        if (condition.minCount > (int)condition.channels.size()) return false; // Can never be met
+        if (condition.aggregate == EventCondition::kDefault) {
+            condition.aggregate = condition.field == EventCondition::kArea ? EventCondition::kTotal : EventCondition::kMax;
+        }
+        return true;
+    }
+};
+
+// Keep only the events of the list that satisfy the predicate
+inline void selectEvents(const EventPredicate &predicate, const EventIndex &index, std::vector<Long64_t> &events) {
+    size_t kept = 0;
+    for (Long64_t EventID : events) {
+        if (EventID < index.nEvents && predicate.matches(index, EventID)) events[kept++] = EventID;
+    }
+    events.resize(kept);
+}
+
+// Resolve a --select predicate against the event index of the run, keeping the matching events
+inline bool applySelection(const RunFiles &run, const DetectorGeometry &geometry, const char *selection, int nWorkers,
+                           std::vector<Long64_t> &events) {
+    EventPredicate predicate;
+    if (!predicate.parse(selection, geometry)) return false;
+
+    EventIndex index;
+    if (!loadRunIndex(run, geometry, index, nWorkers, false)) return false;
+
+    TStopwatch timer;
+    size_t nCandidates = events.size();
+    selectEvents(predicate, index, events);
+    timer.Stop();
+    std::cout << "Selected " << events.size() << " of " << nCandidates << " events matching '" << selection
+              << "' in " << timer.RealTime() * 1000 << " ms" << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,262 @@
+// Batch rendering shared by the plotting tools: selecting the events of a run, distributing them over the worker
+// pool and saving every plot through the PlotOutput. A tool only describes its plots with an EventRenderer:
+// plot 0 is the chart of all channels on one canvas (its grid also lays out the svg and raster charts), plots 1-N
+// show detector channel 0 to N-1 on a canvas of its own, and the tool's functions build the canvases of a worker
+// and draw an event onto them.
+// Reading and the feature scan run in parallel; building, drawing and painting the canvases are serialized by
+// graphicsMutex() (WorkerPool.h), since ROOT graphics go through process-wide globals.
+#ifndef EVENTRENDERER_H
+#define EVENTRENDERER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <numeric>
+#include <algorithm>
+#include <functional>
+#include <TCanvas.h>
+#include <TStopwatch.h>
+#include "DetectorGeometry.h"
+#include "RunFiles.h"
+#include "EventList.h"
+#include "EventPredicate.h"
+#include "EventClassifier.h"
+#include "ToolOptions.h"
+#include "WaveformReader.h"
+#include "WaveformFeatures.h"
+#include "WaveformPlot.h"
+#include "WaveformExport.h"
+#include "PlotOutput.h"
+#include "OutputLayout.h"
+#include "PulseFinder.h"
+#include "Calibration.h"
+#include "WorkerPool.h"
+#include "Profiler.h"
+
+// Canvases and plot objects built once per worker and reused for every event.
+// Plots are indexed by detector channel.
+struct EventCanvases {
+    TCanvas *masterCanvas = nullptr;
+    std::vector<TCanvas*> individualCanvases; // One 800x600 canvas per individual plot
+    std::vector<WaveformPlot> combinedPlots;  // Plots on the master canvas
+    std::vector<WaveformPlot> individualPlots; // Plots on the individual canvases
+    RasterImage raster;                        // Thumbnail of the chart for the raster output, instead of the canvases
+};
+
+// Delete the canvases and the plot objects drawn on them
+inline void deleteCanvases(EventCanvases &canvases) {
+    delete canvases.masterCanvas;
+    for (TCanvas *canvas : canvases.individualCanvases) {
+        delete canvas;
+    }
+    for (std::vector<WaveformPlot> *plots : {&canvases.combinedPlots, &canvases.individualPlots}) {
+        for (WaveformPlot &plot : *plots) {
+            delete plot.graph;
+            delete plot.title;
+            delete plot.infoArea;
+            delete plot.infoBaseline;
+            delete plot.infoPeak;
+            delete plot.pulseMarkers;
+            delete plot.pileUpMarkers;
+            delete plot.infoPulses;
+        }
+    }
+    canvases = EventCanvases();
+}
+
+// Resolve the events to render: eventSpec (all events if null), narrowed down by the --select predicate and the
+// --class of the --classify rules. Returns false if there is nothing to render.
+inline bool selectEvents(const RunFiles &run, const DetectorGeometry &geometry, const OutputLayout &layout, const char *eventSpec,
+                         const ToolOptions &options, std::vector<Long64_t> &events) {
+    // EventIDs are run-global, validated against the event count of all files
+    if (eventSpec) {
+        if (!parseEventList(eventSpec, run.nEntries(), events)) return false;
+    } else {
+        events.resize(run.nEntries());
+        std::iota(events.begin(), events.end(), 0);
+    }
+
+    // Resolve the predicate against the event index, without reading the tree
+    if (options.selection && !applySelection(run, geometry, options.selection, options.nWorkers, events)) return false;
+    if (options.classRules) {
+        if (!applyClassification(run, geometry, layout, options.classRules, options.eventClass, options.nWorkers, events)) return false;
+        if (!options.eventClass && !eventSpec && !options.selection && !options.summary) return false; // Only the class lists were asked for
+    }
+    if (events.empty()) {
+        std::cout << "No events selected" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+struct EventRenderer {
+    const DetectorGeometry *geometry = nullptr;
+    const OutputLayout *layout = nullptr;
+    const PulseFinderConfig *pulseFinder = nullptr; // Pulses are found (and marked) when set
+    const RunCalibration *calibration = nullptr;    // Tables of the run, empty for raw ADC counts
+
+    // Chart of all channels: its grid of detector channels, one per pad or -1 for an empty one
+    int chartRows = 0, chartCols = 0;
+    const std::vector<int> *chartLayout = nullptr;
+    int nIndividualPlots = 0;
+
+    std::function<void(EventCanvases &canvases, int worker)> buildCanvases;
+    std::function<void(EventCanvases &canvases, const WaveformReader &reader, const EventFeatures &features, const EventScale &scale)> drawChart;
+    std::function<void(EventCanvases &canvases, const WaveformReader &reader, const EventFeatures &features, int detectorChannel,
+                       const EventScale &scale)> drawIndividualPlot;
+
+    // Number of plots saved per event: the chart plus the individual plots, or only the thumbnail of the chart for
+    // the raster output
+    int plotsPerEvent(const std::string &format) const {
+        if (format == "raster") return 1;
+        return 1 + nIndividualPlots;
+    }
+
+    // Render and save one plot of the loaded event
+    void renderPlot(const char *runName, const WaveformReader &reader, const EventFeatures &features, Long64_t EventID, int plot,
+                    EventCanvases &canvases, const EventScale &scale, PlotOutput &output) const {
+        if (plot == 0) {
+            if (output.usesCanvas()) {
+                std::lock_guard<std::mutex> graphics(graphicsMutex());
+                drawChart(canvases, reader, features, scale);
+            }
+
+            // Save the combined chart; the JSON dump of the event goes with it
+            std::string combinedChartName = layout->relativePath(Form("CombinedChart_SpecificLayout_%s_Event%lld", runName, EventID), EventID);
+            if (output.rasterized()) {
+                {
+                    ProfileScope scope(Profiler::kRaster);
+                    layoutRaster(canvases.raster, *geometry, reader, chartRows, chartCols, *chartLayout, scale, EventID);
+                }
+                output.saveRaster(canvases.raster, combinedChartName);
+            } else {
+                output.save(canvases.masterCanvas, combinedChartName, [&](const std::string &format) {
+                    if (format == "json") return eventJSON(*geometry, reader, features, EventID, scale.calibration);
+                    return layoutSVG(*geometry, reader, features, chartRows, chartCols, *chartLayout, scale);
+                });
+            }
+            std::lock_guard<std::mutex> lock(consoleMutex());
+            std::cout << "Combined chart saved as " << output.target(combinedChartName) << std::endl;
+        } else {
+            // Save the individual PMT or SiPM plot
+            int detectorChannel = plot - 1;
+            std::string individualName = layout->relativePath(Form("%s%d_%s_Event%lld", geometry->isSiPM(detectorChannel) ? "SiPM" : "PMT",
+                                                                   geometry->channelNumber(detectorChannel), runName, EventID), EventID);
+            if (output.usesCanvas()) {
+                std::lock_guard<std::mutex> graphics(graphicsMutex());
+                drawIndividualPlot(canvases, reader, features, detectorChannel, scale);
+            }
+            output.save(output.usesCanvas() ? canvases.individualCanvases[detectorChannel] : nullptr, individualName, [&](const std::string &format) {
+                if (format == "json") return std::string(); // The event dump already holds every channel
+                return channelSVG(*geometry, reader, features, detectorChannel, scale);
+            });
+        }
+    }
+
+    // Render all plots of the events in the given output format.
+    // The plots of all events are distributed over the worker threads, each with its own file and canvases.
+    void render(const RunFiles &run, const std::vector<Long64_t> &events, int nWorkers, const std::string &format) const {
+        TStopwatch timer;
+        const char *runName = layout->runName.c_str(); // Used in the output file names
+
+        // With enough events every event is one task, so each worker only reads its own events;
+        // otherwise the plots of an event are split into separate tasks. No more workers than tasks are started.
+        if (nWorkers < 1) nWorkers = defaultWorkerCount();
+        int nPlotsPerEvent = plotsPerEvent(format);
+        size_t tasksPerEvent = events.size() >= (size_t)nWorkers ? 1 : nPlotsPerEvent;
+        size_t nTasks = events.size() * tasksPerEvent;
+        if ((size_t)nWorkers > nTasks) nWorkers = (int)nTasks;
+
+        Long64_t firstEvent = *std::min_element(events.begin(), events.end());
+        Long64_t lastEvent = *std::max_element(events.begin(), events.end());
+
+        // Prefetch baskets ahead of the loop when more than one event is rendered
+        if (events.size() > 1) WaveformReader::enableAsyncPrefetching();
+
+        // Encoding runs behind the workers on the output's own threads
+        PlotOutput output(format, nWorkers, *layout, Form("Plots_%s", runName));
+
+        std::atomic<size_t> nextTask(0);
+        std::atomic<Long64_t> totalBytesRead(0), totalBytesDecompressed(0), totalEventsLoaded(0);
+        runWorkers(nWorkers, [&](int worker) {
+            // Each worker binds the branches and builds the canvases once for all its tasks
+            profiler().nameThread("render " + std::to_string(worker));
+            WaveformReader reader;
+            {
+                ProfileScope scope(Profiler::kOpen);
+                if (!reader.open(run, *geometry)) return;
+                reader.setEntryRange(firstEvent, lastEvent);
+            }
+
+            EventCanvases canvases;
+            if (output.usesCanvas()) { // svg, json and raster are drawn from the data
+                std::lock_guard<std::mutex> graphics(graphicsMutex());
+                ProfileScope scope(Profiler::kBuild);
+                buildCanvases(canvases, worker);
+            }
+
+            Long64_t loadedEvent = -1;
+            EventFeatures features;
+            EventScale scale;
+            for (size_t task = nextTask++; task < nTasks; task = nextTask++) {
+                Long64_t EventID = events[task / tasksPerEvent];
+                if (EventID != loadedEvent) {
+                    // Load the specified event into memory
+                    {
+                        ProfileScope scope(Profiler::kGetEntry);
+                        if (!reader.load(EventID)) continue;
+                    }
+                    {
+                        ProfileScope scope(Profiler::kFeatures);
+                        reader.extractFeatures(features);
+                    }
+                    if (pulseFinder) {
+                        ProfileScope scope(Profiler::kPulses);
+                        reader.findPulses(features, *pulseFinder);
+                    }
+                    scale = eventScale(features, calibration->forFile(reader.runFile));
+                    loadedEvent = EventID;
+                }
+                int firstPlot = tasksPerEvent == 1 ? 0 : task % tasksPerEvent;
+                int lastPlot = tasksPerEvent == 1 ? nPlotsPerEvent - 1 : firstPlot;
+                for (int plot = firstPlot; plot <= lastPlot; plot++) {
+                    renderPlot(runName, reader, features, EventID, plot, canvases, scale, output);
+                }
+            }
+
+            totalBytesRead += reader.bytesRead();
+            totalBytesDecompressed += reader.bytesDecompressed;
+            totalEventsLoaded += reader.eventsLoaded;
+            profiler().count(Profiler::kBytesRead, reader.bytesRead());
+            profiler().count(Profiler::kBytesDecompressed, reader.bytesDecompressed);
+            profiler().count(Profiler::kEventsLoaded, reader.eventsLoaded);
+
+            std::lock_guard<std::mutex> graphics(graphicsMutex());
+            deleteCanvases(canvases);
+        });
+        output.finish();
+
+        timer.Stop();
+        if (events.size() > 1) {
+            double seconds = timer.RealTime();
+            std::cout << "Rendered " << events.size() << " events in " << seconds << " s ("
+                      << (seconds > 0 ? events.size() / seconds : 0) << " events/s, " << nWorkers << " workers)" << std::endl;
+            std::cout << "Peak RSS: " << peakRSSMB() << " MB" << std::endl;
+        }
+
+        // Bytes written per event and the time spent encoding, summed over the encoder threads
+        std::cout << "Output: " << output.format << ", " << output.filesWritten << " files, " << output.bytesWritten / 1024.0 / events.size()
+                  << " kB per event, encoding " << output.encodeMicroseconds / 1e6 << " s on " << output.nEncoders << " threads" << std::endl;
+
+        // I/O per loaded event, summed over all workers
+        if (totalEventsLoaded > 0) {
+            std::cout << "I/O: " << totalBytesRead / 1024.0 / totalEventsLoaded << " kB read and "
+                      << totalBytesDecompressed / 1024.0 / totalEventsLoaded << " kB decompressed per event ("
+                      << totalEventsLoaded << " event loads)" << std::endl;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,70 @@
+// Waiting for a file that another process (the DAQ) is still writing. With inotify the wait ends as soon
+// as the writer modifies the file; where inotify is not available (e.g. some network filesystems) the wait
+// simply times out, so the caller falls back to polling at its update interval.
+// SIGINT/SIGTERM only set a flag (followStopRequested), so a follow loop (or the plot server, PlotServer.h) can finish
+// its last update and exit cleanly.
+#ifndef FILEWATCHER_H
+#define FILEWATCHER_H
+
+#include <csignal>
+#include <cerrno>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+struct FileWatcher {
+    int notifyFd = -1;
+
+    FileWatcher() {}
+    FileWatcher(const FileWatcher &) = delete;
+    FileWatcher &operator=(const FileWatcher &) = delete;
+    ~FileWatcher() { close(); }
+
+    // Watch fileName for writes; returns false (and keeps working by timeouts only) if inotify can't watch it
+    bool open(const char *fileName) {
+        close();
+        notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notifyFd < 0) return false;
+        if (inotify_add_watch(notifyFd, fileName, IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // Wait until the file is written or timeoutMs have passed; returns true if it was written
+    bool wait(int timeoutMs) {
+        if (notifyFd < 0) {
+            usleep(timeoutMs * 1000);
+            return false;
+        }
+        pollfd request = {notifyFd, POLLIN, 0};
+        if (poll(&request, 1, timeoutMs) <= 0) return false;
+
+        // Drain the queued events, one write is as good as many
+        char buffer[4096];
+        while (read(notifyFd, buffer, sizeof(buffer)) > 0) {}
+        return true;
+    }
+
+    void close() {
+        if (notifyFd >= 0) ::close(notifyFd);
+        notifyFd = -1;
+    }
+};
+
+inline volatile sig_atomic_t &followStopRequested() {
+    static volatile sig_atomic_t stop = 0;
+    return stop;
+}
+
+// Turn SIGINT and SIGTERM into a stop request for the follow loop or the plot server
+inline void installFollowStopHandler() {
+    struct sigaction action = {};
+    action.sa_handler = [](int) { followStopRequested() = 1; };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+#endif
@@ -0,0 +1,107 @@
+// Where the tools write their files, selected with --output-dir and --shard:
+//   <output-dir>/<name>                                   --shard none (the default), one flat directory
+//   <output-dir>/<run>/<name>                             --shard run, one directory per run
+//   <output-dir>/<run>/events_<first>-<last>/<name>       --shard <N>, and in it one directory per block of N events
+// <run> is the run label without its directory, so the input path never ends up in the output names.
+// Files are written under a hidden temporary name in their target directory and renamed into place when complete,
+// so parallel workers never write into each other's files and a reader never sees a half-written one.
+#ifndef OUTPUTLAYOUT_H
+#define OUTPUTLAYOUT_H
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <TCanvas.h>
+
+// Output root when no --output-dir is given, relative to the working directory
+const char *const defaultOutputDirectory = "plots";
+
+struct OutputLayout {
+    std::string directory = defaultOutputDirectory; // Output root
+    bool shardRun = false;                          // One subdirectory per run
+    Long64_t shardEvents = 0;                       // Events per subdirectory of the run, 0 for none
+    bool pack = false;                              // Per-plot files go into one tar archive per batch (PlotOutput.h)
+    std::string runName;                            // Run label without its directory
+
+    void setRun(const std::string &runLabel) {
+        runName = runLabel.substr(runLabel.rfind('/') + 1);
+    }
+
+    // Path of an output file relative to the output root; files of the whole run pass no EventID
+    std::string relativePath(const std::string &name, Long64_t EventID = -1) const {
+        std::string path = shardRun ? runName + "/" : "";
+        if (shardEvents > 0 && EventID >= 0) {
+            Long64_t first = EventID / shardEvents * shardEvents;
+            path += "events_" + std::to_string(first) + "-" + std::to_string(first + shardEvents - 1) + "/";
+        }
+        return path + name;
+    }
+
+    std::string path(const std::string &name, Long64_t EventID = -1) const {
+        return directory + "/" + relativePath(name, EventID);
+    }
+};
+
+// --shard none, run or a number of events per directory
+inline bool parseOutputSharding(const std::string &shard, OutputLayout &layout) {
+    layout.shardRun = shard != "none";
+    layout.shardEvents = 0;
+    if (shard == "none" || shard == "run") return true;
+    char *end = nullptr;
+    long long events = strtoll(shard.c_str(), &end, 10);
+    if (shard.empty() || *end != '\0' || events < 1) {
+        std::cerr << "Error: --shard takes none, run or a number of events per directory, not '" << shard << "'" << std::endl;
+        return false;
+    }
+    layout.shardEvents = events;
+    return true;
+}
+
+inline std::string parentDirectory(const std::string &path) {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos) return ".";
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+// Create a directory and its missing parents
+inline bool makeDirectories(const std::string &directory) {
+    for (size_t slash = directory.find('/', 1);; slash = directory.find('/', slash + 1)) {
+        std::string part = directory.substr(0, slash);
+        if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) {
+            std::cerr << "Error creating directory: " << part << std::endl;
+            return false;
+        }
+        if (slash == std::string::npos) return true;
+    }
+}
+
+// Hidden name in the directory of fileName to write it under first. It keeps the extension, which ROOT picks the
+// image format by, and holds the process ID so two runs writing the same file don't share it.
+inline std::string temporaryFileName(const std::string &fileName) {
+    size_t name = fileName.rfind('/') + 1;
+    return fileName.substr(0, name) + ".partial_" + std::to_string(getpid()) + "_" + fileName.substr(name);
+}
+
+// Move a completely written temporary file to its final name (atomic within a filesystem)
+inline bool commitFile(const std::string &temporaryName, const std::string &fileName) {
+    if (rename(temporaryName.c_str(), fileName.c_str()) != 0) {
+        std::cerr << "Error writing file: " << fileName << std::endl;
+        unlink(temporaryName.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Save a canvas under a temporary name and rename it into place, so a viewer never shows a half-written image
+inline bool saveCanvasAtomically(TCanvas *canvas, const std::string &imageFileName) {
+    if (!makeDirectories(parentDirectory(imageFileName))) return false;
+    std::string temporaryName = temporaryFileName(imageFileName);
+    canvas->SaveAs(temporaryName.c_str());
+    return commitFile(temporaryName, imageFileName);
+}
+
+#endif
@@ -0,0 +1,373 @@
+// Output stage for rendered plots, selected with --output:
+//   png    full-size PNG per plot (the default)
+//   thumb  PNG per plot, downscaled by thumbnailScale
+//   raster small PNG thumbnail per event, drawn by the native rasterizer (RasterImage.h) without any ROOT canvas
+//   svg    compact hand-written SVG per plot, drawn from the waveform data (no ROOT canvas involved)
+//   json   one JSON dump per event with the samples and features of every channel, for browser-side rendering
+//   pdf    one multi-page PDF for the whole batch, one page per plot
+//   root   one ROOT file for the whole batch holding every canvas
+// Encoding runs on background threads behind the render workers: a worker only hands over a raster of the canvas
+// (png, thumb), a copy of it (pdf, root), a copy of its thumbnail image (raster) or the finished document text
+// (svg, json) and goes on with the next plot.
+// svg, json and raster never touch ROOT and are encoded by as many threads as there are workers. The canvas formats
+// are encoded by one thread under graphicsMutex() (WorkerPool.h), like the drawing itself, since TImage and the
+// pdf and root output go through ROOT's graphics globals; for pdf and root that thread also owns the batch file. The queue is bounded, so rendering can't run ahead of encoding by more than a few plots.
+// Files go where the OutputLayout puts them and are renamed into place once complete. With --pack the per-plot
+// formats are encoded in parallel as before but appended to one tar archive per batch instead of one file per plot.
+#ifndef PLOTOUTPUT_H
+#define PLOTOUTPUT_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <deque>
+#include <set>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <TCanvas.h>
+#include <TImage.h>
+#include <TFile.h>
+#include <TROOT.h>
+#include "OutputLayout.h"
+#include "TarArchive.h"
+#include "Profiler.h"
+#include "RasterImage.h"
+#include "WorkerPool.h"
+
+const char *const outputFormatNames = "png, thumb, raster, svg, json, pdf or root";
+
+// Thumbnails are this many times smaller than the canvas in each direction
+const int thumbnailScale = 4;
+
+inline bool isOutputFormat(const std::string &format) {
+    return format == "png" || format == "thumb" || format == "raster" || format == "svg" || format == "json" || format == "pdf" ||
+           format == "root";
+}
+
+inline Long64_t fileSize(const std::string &fileName) {
+    struct stat fileStat;
+    return stat(fileName.c_str(), &fileStat) == 0 ? (Long64_t)fileStat.st_size : 0;
+}
+
+// Encode a canvas image as a PNG in memory, first downscaled by thumbnailScale for a thumbnail
+inline bool encodeImagePNG(TImage *image, bool thumbnail, std::string &png) {
+    if (thumbnail) image->Scale(image->GetWidth() / thumbnailScale, image->GetHeight() / thumbnailScale);
+    char *buffer = nullptr;
+    int size = 0;
+    image->GetImageBuffer(&buffer, &size, TImage::kPng);
+    if (!buffer) return false;
+    png.assign(buffer, size);
+    free(buffer);
+    return true;
+}
+
+// Paint a canvas and encode it as a PNG in memory (png and thumb, e.g. for the plot server). Callers hold
+// graphicsMutex() when other threads may draw.
+inline bool encodeCanvasPNG(TCanvas *canvas, bool thumbnail, std::string &png) {
+    TImage *image = TImage::Create();
+    image->FromPad(canvas);
+    bool ok = encodeImagePNG(image, thumbnail, png);
+    delete image;
+    return ok;
+}
+
+// Builds the document of a plot for the text formats; called with "svg" or "json", returns "" if the plot has none
+typedef std::function<std::string(const std::string &format)> PlotDocument;
+
+class PlotOutput {
+public:
+    // batchName is the name of the batch file (pdf, root or the archive of a packed batch), without extension
+    PlotOutput(const std::string &format, int nWorkers, const OutputLayout &layout, const std::string &batchName)
+        : format(format), layout(layout), nEncoders(usesCanvas(format) ? 1 : std::max(nWorkers, 1)), capacity(2 * (size_t)nEncoders) {
+        if (isBatchFormat()) batchFileName = layout.path(batchName + "." + format);
+        else if (layout.pack) batchFileName = layout.path(batchName + "_" + format + ".tar");
+        if (!batchFileName.empty()) {
+            makeDirectories(parentDirectory(batchFileName));
+            batchTemporaryName = temporaryFileName(batchFileName);
+        }
+        ROOT::EnableThreadSafety(); // Encoders handle ROOT objects next to the render workers
+        for (int encoder = 0; encoder < nEncoders; encoder++) {
+            encoders.emplace_back(&PlotOutput::encode, this);
+        }
+    }
+    PlotOutput(const PlotOutput &) = delete;
+    PlotOutput &operator=(const PlotOutput &) = delete;
+    ~PlotOutput() { finish(); }
+
+    // pdf and root write all plots into one file
+    static bool isBatchFormat(const std::string &format) {
+        return format == "pdf" || format == "root";
+    }
+
+    bool isBatchFormat() const {
+        return isBatchFormat(format);
+    }
+
+    // Per-plot formats packed into one archive
+    bool packed() const {
+        return layout.pack && !isBatchFormat();
+    }
+
+    // svg, json and raster are built from the data, the other formats need the plot drawn on its canvas
+    static bool usesCanvas(const std::string &format) {
+        return format != "svg" && format != "json" && format != "raster";
+    }
+
+    bool usesCanvas() const {
+        return usesCanvas(format);
+    }
+
+    // raster thumbnails are saved with saveRaster() instead of save()
+    bool rasterized() const {
+        return format == "raster";
+    }
+
+    // Name of a plot saved under baseName (a path relative to the output root, without extension)
+    std::string plotName(const std::string &baseName) const {
+        if (format == "thumb") return baseName + "_thumb.png";
+        if (format == "raster") return baseName + "_raster.png";
+        return baseName + "." + format;
+    }
+
+    // File a plot saved under baseName ends up in
+    std::string target(const std::string &baseName) const {
+        if (!batchFileName.empty()) return batchFileName;
+        return layout.directory + "/" + plotName(baseName);
+    }
+
+    // Queue a plot for encoding: the canvas for the image formats, document(format) for svg and json, which take no
+    // canvas (it may be null). The canvas can be drawn again as soon as this returns.
+    void save(TCanvas *canvas, const std::string &baseName, const PlotDocument &document) {
+        std::string name = plotName(baseName);
+        if (format == "svg" || format == "json") {
+            std::string text;
+            {
+                ProfileScope scope(Profiler::kDocument);
+                text = document(format);
+            }
+            if (text.empty()) return;
+            push([this, name, text]() {
+                return writePlot(name, text.data(), text.size());
+            });
+        } else if (format == "png" || format == "thumb") {
+            TImage *image = nullptr;
+            {
+                std::lock_guard<std::mutex> graphics(graphicsMutex()); // FromPad paints through the global gVirtualPS
+                ProfileScope scope(Profiler::kRaster);
+                image = TImage::Create();
+                image->FromPad(canvas);
+            }
+            profiler().count(Profiler::kObjectsAllocated);
+            bool thumbnail = format == "thumb";
+            push([this, name, image, thumbnail]() {
+                Long64_t bytes = 0;
+                if (packed()) {
+                    // Encode in memory, the append to the archive runs outside the graphics lock
+                    std::string png;
+                    bool encoded = false;
+                    {
+                        std::lock_guard<std::mutex> graphics(graphicsMutex());
+                        encoded = encodeImagePNG(image, thumbnail, png);
+                        delete image;
+                    }
+                    if (encoded) bytes = writePlot(name, png.data(), png.size());
+                } else {
+                    std::string fileName = layout.directory + "/" + name;
+                    std::string temporaryName = temporaryFileName(fileName);
+                    bool directory = makeDirectory(parentDirectory(fileName));
+                    {
+                        std::lock_guard<std::mutex> graphics(graphicsMutex());
+                        if (directory) {
+                            if (thumbnail) image->Scale(image->GetWidth() / thumbnailScale, image->GetHeight() / thumbnailScale);
+                            image->WriteImage(temporaryName.c_str());
+                        }
+                        delete image;
+                    }
+                    if (directory && commitFile(temporaryName, fileName)) bytes = fileSize(fileName);
+                }
+                return bytes;
+            });
+        } else {
+            // The batch file is only touched by the encoder thread, which gets its own copy of the canvas
+            TCanvas *copy = nullptr;
+            {
+                std::lock_guard<std::mutex> graphics(graphicsMutex());
+                ProfileScope scope(Profiler::kRaster);
+                copy = (TCanvas*)canvas->Clone(baseName.substr(baseName.rfind('/') + 1).c_str());
+            }
+            profiler().count(Profiler::kObjectsAllocated);
+            push([this, copy]() {
+                std::lock_guard<std::mutex> graphics(graphicsMutex());
+                if (format == "pdf") {
+                    if (!pdfOpen) copy->Print((batchTemporaryName + "[").c_str());
+                    pdfOpen = true;
+                    copy->Print(batchTemporaryName.c_str(), (std::string("Title:") + copy->GetName()).c_str());
+                } else {
+                    if (!batchFile) batchFile = TFile::Open(batchTemporaryName.c_str(), "RECREATE");
+                    if (batchFile && !batchFile->IsZombie()) batchFile->WriteTObject(copy, copy->GetName());
+                }
+                delete copy;
+                return (Long64_t)0; // Counted when the batch file is closed
+            });
+        }
+    }
+
+    // Queue a thumbnail for PNG encoding; the image can be drawn again as soon as this returns
+    void saveRaster(const RasterImage &image, const std::string &baseName) {
+        std::string name = plotName(baseName);
+        push([this, name, image]() {
+            thread_local PNGEncoder encoder; // Keeps its deflate stream and buffers between plots
+            std::string png;
+            if (!encoder.encode(image, png)) {
+                std::cerr << "Error encoding PNG: " << name << std::endl;
+                return (Long64_t)0;
+            }
+            return writePlot(name, png.data(), png.size());
+        });
+    }
+
+    // Wait until everything queued is written and close the batch file
+    void finish() {
+        if (encoders.empty()) return;
+        if (isBatchFormat()) {
+            push([this]() {
+                {
+                    std::lock_guard<std::mutex> graphics(graphicsMutex());
+                    if (pdfOpen) {
+                        TCanvas closer("PlotOutputCloser", "", 10, 10);
+                        closer.Print((batchTemporaryName + "]").c_str());
+                    }
+                    if (batchFile) {
+                        batchFile->Close();
+                        delete batchFile;
+                        batchFile = nullptr;
+                    }
+                }
+                if (fileSize(batchTemporaryName) == 0) return (Long64_t)0; // Nothing was saved
+                if (!commitFile(batchTemporaryName, batchFileName)) return (Long64_t)0;
+                filesWritten++;
+                profiler().count(Profiler::kFilesWritten);
+                return fileSize(batchFileName);
+            });
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        notEmpty.notify_all();
+        for (std::thread &encoder : encoders) {
+            encoder.join();
+        }
+        encoders.clear();
+
+        // The archive counts its members as files; its end blocks count towards the bytes
+        if (archive.isOpen() && archive.close() && commitFile(batchTemporaryName, batchFileName)) {
+            bytesWritten += TarArchive::trailerSize;
+            profiler().count(Profiler::kBytesWritten, TarArchive::trailerSize);
+        }
+    }
+
+    const std::string format;
+    const OutputLayout layout;
+    const int nEncoders;
+    std::atomic<Long64_t> bytesWritten{0};
+    std::atomic<Long64_t> filesWritten{0};
+    std::atomic<Long64_t> encodeMicroseconds{0}; // Summed over the encoder threads
+
+private:
+    typedef std::function<Long64_t()> EncodeJob; // Writes its output and returns the bytes written
+
+    // Write an encoded plot to its own file, or append it to the archive; returns the bytes written
+    Long64_t writePlot(const std::string &name, const char *data, size_t size) {
+        if (packed()) {
+            std::lock_guard<std::mutex> lock(archiveMutex);
+            if (!archive.isOpen() && !archive.open(batchTemporaryName)) return 0;
+            return archive.add(name, data, size);
+        }
+        std::string fileName = layout.directory + "/" + name;
+        if (!makeDirectory(parentDirectory(fileName))) return 0;
+        std::string temporaryName = temporaryFileName(fileName);
+        {
+            std::ofstream out(temporaryName, std::ios::binary);
+            out.write(data, size);
+            if (!out) {
+                std::cerr << "Error writing file: " << fileName << std::endl;
+                return 0;
+            }
+        }
+        return commitFile(temporaryName, fileName) ? (Long64_t)size : 0;
+    }
+
+    // Create an output (shard) directory the first time a plot goes into it
+    bool makeDirectory(const std::string &directory) {
+        std::lock_guard<std::mutex> lock(directoriesMutex);
+        if (directories.count(directory)) return true;
+        if (!makeDirectories(directory)) return false;
+        directories.insert(directory);
+        return true;
+    }
+
+    void push(EncodeJob job) {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (jobs.size() >= capacity) {
+            ProfileScope scope(Profiler::kQueueWait);
+            notFull.wait(lock, [this]() { return jobs.size() < capacity; });
+        }
+        jobs.push_back(std::move(job));
+        lock.unlock();
+        notEmpty.notify_one();
+    }
+
+    void encode() {
+        profiler().nameThread("encoder");
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            notEmpty.wait(lock, [this]() { return closing || !jobs.empty(); });
+            if (jobs.empty()) return; // Closing and drained
+            EncodeJob job = std::move(jobs.front());
+            jobs.pop_front();
+            lock.unlock();
+            notFull.notify_one();
+
+            auto start = std::chrono::steady_clock::now();
+            Long64_t bytes = 0;
+            {
+                ProfileScope scope(Profiler::kEncode);
+                bytes = job();
+            }
+            encodeMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            bytesWritten += bytes;
+            profiler().count(Profiler::kBytesWritten, bytes);
+            if (!isBatchFormat() && bytes > 0) {
+                filesWritten++;
+                profiler().count(Profiler::kFilesWritten);
+            }
+        }
+    }
+
+    size_t capacity;
+    std::string batchFileName;       // pdf, root, or the archive of a packed batch
+    std::string batchTemporaryName;  // Written until the batch is finished
+    TFile *batchFile = nullptr; // root: opened by the encoder on the first plot
+    bool pdfOpen = false;
+    TarArchive archive;         // Packed batch: opened on the first plot, appended to by all encoders
+    std::mutex archiveMutex;
+    std::set<std::string> directories; // Output directories known to exist
+    std::mutex directoriesMutex;
+
+    std::mutex mutex;
+    std::condition_variable notEmpty, notFull;
+    std::deque<EncodeJob> jobs;
+    bool closing = false;
+    std::vector<std::thread> encoders;
+};
+
+#endif
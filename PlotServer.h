@@ -0,0 +1,257 @@
+// Long-running plot server: keeps the ROOT file open and answers render requests on a Unix domain socket.
+// The protocol is line based; a client sends one request per line on the same connection, e.g.
+//   render 42 layout=full format=png
+// and gets back either "OK <nbytes>\n" followed by the image bytes, or "ERR <message>\n".
+// Any number of clients can stay connected: they are polled together and their requests rendered one at a time.
+// Rendered images are kept in an LRU cache so clicking back and forth between events is free.
+// SIGINT/SIGTERM stop the server after the request in progress and remove its socket.
+#ifndef PLOTSERVER_H
+#define PLOTSERVER_H
+
+#include <iostream>
+#include <functional>
+#include <list>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Rtypes.h"
+#include "FileWatcher.h"
+
+// Number of rendered images kept by the server
+const size_t plotCacheEntries = 256;
+
+// Longest request line; a client sending more without a newline is disconnected
+const size_t maxPlotRequestLine = 1024;
+
+// A client that doesn't read its reply for this long is disconnected, so it can't stall the others
+const int plotClientSendTimeout = 5;
+
+struct PlotRequest {
+    Long64_t EventID = -1;
+    std::string layout = "full"; // full or pmt
+    std::string format = "png";  // png, thumb, raster, svg or json (PlotOutput.h)
+
+    std::string key() const {
+        return std::to_string(EventID) + "/" + layout + "/" + format;
+    }
+};
+
+// Parse "render <EventID> [layout=full|pmt] [format=png|thumb|raster|svg|json]"
+inline bool parsePlotRequest(const std::string &line, PlotRequest &request, std::string &error) {
+    std::istringstream words(line);
+    std::string command;
+    words >> command;
+    if (command != "render") {
+        error = "unknown command '" + command + "'";
+        return false;
+    }
+    if (!(words >> request.EventID)) {
+        error = "missing EventID";
+        return false;
+    }
+    std::string word;
+    while (words >> word) {
+        if (word.compare(0, 7, "layout=") == 0) request.layout = word.substr(7);
+        else if (word.compare(0, 7, "format=") == 0) request.format = word.substr(7);
+        else {
+            error = "unknown argument '" + word + "'";
+            return false;
+        }
+    }
+    if (request.layout != "full" && request.layout != "pmt") {
+        error = "layout must be full or pmt";
+        return false;
+    }
+    if (request.format != "png" && request.format != "thumb" && request.format != "raster" && request.format != "svg" &&
+        request.format != "json") {
+        error = "format must be png, thumb, raster, svg or json";
+        return false;
+    }
+    return true;
+}
+
+// Least recently used cache of rendered images
+class PlotCache {
+public:
+    explicit PlotCache(size_t capacity) : capacity(capacity) {}
+
+    bool get(const std::string &key, std::string &bytes) {
+        auto found = entries.find(key);
+        if (found == entries.end()) return false;
+        order.splice(order.begin(), order, found->second); // Most recently used first
+        bytes = found->second->second;
+        return true;
+    }
+
+    void put(const std::string &key, const std::string &bytes) {
+        if (capacity == 0) return;
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            order.erase(found->second);
+            entries.erase(found);
+        }
+        order.emplace_front(key, bytes);
+        entries[key] = order.begin();
+        if (entries.size() > capacity) {
+            entries.erase(order.back().first);
+            order.pop_back();
+        }
+    }
+
+private:
+    size_t capacity;
+    std::list<std::pair<std::string, std::string>> order;
+    std::unordered_map<std::string, std::list<std::pair<std::string, std::string>>::iterator> entries;
+};
+
+inline bool sendAll(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+// Renders the requested plot into bytes; returns false with an error message on failure
+typedef std::function<bool(const PlotRequest &, std::string &bytes, std::string &error)> PlotRenderer;
+
+// Remove the socket a previous server left behind. Fails if anything else is at socketPath: a file that is not a
+// socket, or the socket of a server that still accepts connections.
+inline bool removeStaleSocket(const char *socketPath, const sockaddr_un &address) {
+    struct stat entry;
+    if (lstat(socketPath, &entry) != 0) return errno == ENOENT;
+    if (!S_ISSOCK(entry.st_mode)) {
+        std::cerr << "Error: " << socketPath << " exists and is not a socket" << std::endl;
+        return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    bool listening = probe >= 0 && connect(probe, (const sockaddr*)&address, sizeof(address)) == 0;
+    if (probe >= 0) close(probe);
+    if (listening) {
+        std::cerr << "Error: another server is listening on " << socketPath << std::endl;
+        return false;
+    }
+    if (unlink(socketPath) != 0 && errno != ENOENT) {
+        std::cerr << "Error: can't remove stale socket " << socketPath << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Buffered requests of one connected client
+struct PlotClient {
+    int fd;
+    std::string pending; // Received, not yet complete request line
+};
+
+// Answer the complete request lines a client has sent; returns false if the client has to be disconnected
+inline bool answerPlotRequests(PlotClient &client, const PlotRenderer &render, PlotCache &cache) {
+    size_t newline;
+    while ((newline = client.pending.find('\n')) != std::string::npos) {
+        std::string line = client.pending.substr(0, newline);
+        client.pending.erase(0, newline + 1);
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (line.empty()) continue;
+
+        PlotRequest request;
+        std::string bytes, error;
+        bool ok = parsePlotRequest(line, request, error);
+        if (ok && !cache.get(request.key(), bytes)) {
+            ok = render(request, bytes, error);
+            if (ok) cache.put(request.key(), bytes);
+        }
+
+        std::string header = ok ? "OK " + std::to_string(bytes.size()) + "\n" : "ERR " + error + "\n";
+        if (!sendAll(client.fd, header.data(), header.size()) || (ok && !sendAll(client.fd, bytes.data(), bytes.size()))) return false;
+    }
+    return client.pending.size() <= maxPlotRequestLine;
+}
+
+// Accept connections on socketPath and answer render requests until SIGINT/SIGTERM; returns false if the socket
+// can't be set up
+inline bool servePlots(const char *socketPath, const PlotRenderer &render, size_t cacheEntries) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path)) {
+        std::cerr << "Error: socket path too long: " << socketPath << std::endl;
+        return false;
+    }
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+
+    if (!removeStaleSocket(socketPath, address)) return false;
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0 || bind(server, (sockaddr*)&address, sizeof(address)) != 0 || listen(server, 16) != 0) {
+        std::cerr << "Error: can't listen on " << socketPath << ": " << strerror(errno) << std::endl;
+        if (server >= 0) close(server);
+        return false;
+    }
+    installFollowStopHandler(); // So the socket is removed on Ctrl-C
+    std::cout << "Serving plots on " << socketPath << std::endl;
+
+    PlotCache cache(cacheEntries);
+    std::list<PlotClient> clients;
+    std::vector<pollfd> polled;
+    bool ok = true;
+    while (!followStopRequested()) {
+        polled.assign(1, pollfd{server, POLLIN, 0});
+        for (const PlotClient &client : clients) polled.push_back(pollfd{client.fd, POLLIN, 0});
+        if (poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Error: poll failed: " << strerror(errno) << std::endl;
+            ok = false;
+            break;
+        }
+
+        // Requests of the clients connected before this poll, in the order of the poll list
+        auto client = clients.begin();
+        for (size_t i = 1; i < polled.size(); i++) {
+            bool connected = true;
+            if (polled[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                char buffer[4096];
+                ssize_t received = recv(client->fd, buffer, sizeof(buffer), 0);
+                if (received > 0) {
+                    client->pending.append(buffer, received);
+                    connected = answerPlotRequests(*client, render, cache);
+                } else {
+                    connected = received < 0 && (errno == EINTR || errno == EAGAIN);
+                }
+            }
+            if (connected) {
+                ++client;
+            } else {
+                close(client->fd);
+                client = clients.erase(client);
+            }
+        }
+
+        if (polled[0].revents & POLLIN) {
+            int fd = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                timeval timeout = {plotClientSendTimeout, 0};
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                clients.push_back(PlotClient{fd, std::string()});
+            }
+        }
+    }
+
+    for (const PlotClient &client : clients) close(client.fd);
+    close(server);
+    unlink(socketPath);
+    std::cout << "Stopped serving plots on " << socketPath << std::endl;
+    return ok;
+}
+
+#endif
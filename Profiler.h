@@ -0,0 +1,300 @@
+// Instrumentation of the rendering pipeline, enabled with --profile and --trace <file.json>. Each stage of the
+// pipeline is wrapped in a ProfileScope; when profiling is off a scope costs one branch. When on, every scope
+// appends its start and duration to a buffer of its own thread, so threads never contend, and counters
+// (bytes read, objects allocated, files written, ...) are atomics added to a few times per event or per plot.
+// At the end, --profile prints per stage the count, total, mean and percentiles of the latency across the batch,
+// and --trace writes every scope as a Chrome trace (chrome://tracing or ui.perfetto.dev) with one track per render
+// worker and encoder, so the overlap of the stages shows. --profile-rss <ms> samples the resident set size.
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <unistd.h>
+#include "Rtypes.h"
+
+// Latencies of one stage in microseconds
+struct StageTimes {
+    std::vector<double> us;
+
+    void add(std::chrono::steady_clock::time_point start) {
+        us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    double total() const {
+        double sum = 0;
+        for (double t : us) sum += t;
+        return sum;
+    }
+
+    // Nearest-rank percentile of a sorted copy
+    static double percentile(const std::vector<double> &sorted, double p) {
+        if (sorted.empty()) return 0;
+        size_t rank = (size_t)(p / 100 * (sorted.size() - 1) + 0.5);
+        return sorted[rank];
+    }
+
+    void writeJSON(std::ostream &out, const char *name) const {
+        std::vector<double> sorted(us);
+        std::sort(sorted.begin(), sorted.end());
+        out << "    \"" << name << "\": {\"count\": " << us.size() << ", \"total_s\": " << total() / 1e6
+            << ", \"mean_us\": " << (us.empty() ? 0 : total() / us.size()) << ", \"p50_us\": " << percentile(sorted, 50)
+            << ", \"p95_us\": " << percentile(sorted, 95) << ", \"p99_us\": " << percentile(sorted, 99)
+            << ", \"max_us\": " << (sorted.empty() ? 0 : sorted.back()) << "}";
+    }
+
+    // One row of the --profile table
+    void print(std::ostream &out, const char *name) const {
+        std::vector<double> sorted(us);
+        std::sort(sorted.begin(), sorted.end());
+        out << "  " << std::left << std::setw(12) << name << std::right << std::setw(10) << us.size() << std::fixed
+            << std::setprecision(3) << std::setw(11) << total() / 1e6 << std::setprecision(1)
+            << std::setw(11) << (us.empty() ? 0 : total() / us.size()) << std::setw(11) << percentile(sorted, 50)
+            << std::setw(11) << percentile(sorted, 95) << std::setw(11) << percentile(sorted, 99)
+            << std::setw(11) << (sorted.empty() ? 0 : sorted.back()) << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+};
+
+// Resident set size of the process in MB
+inline double currentRSSMB() {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (!statm) return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(statm);
+    return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+}
+
+class Profiler {
+public:
+    enum Stage {
+        kOpen,      // Opening the file(s) and binding the branches
+        kBuild,     // Creating the canvases, graphs and labels of a worker
+        kGetEntry,  // Loading an event (GetEntry, or pointing into the cache)
+        kFeatures,  // Feature scan of all channels
+        kPulses,    // Pulse finding
+        kFill,      // Filling the samples into a graph
+        kLabels,    // Setting the label texts and markers of a plot
+        kRaster,    // Painting a canvas into an image (TImage::FromPad, where the TLatex labels are drawn), copying it, or drawing a raster thumbnail
+        kDocument,  // Building the svg/json text of a plot
+        kQueueWait, // Render worker waiting for room in the encoder queue
+        kEncode,    // Encoding and writing a plot, on an encoder thread
+        nStages
+    };
+
+    enum Counter {
+        kBytesRead,         // Compressed bytes read from the ROOT files
+        kBytesDecompressed, // Bytes returned by GetEntry
+        kEventsLoaded,
+        kObjectsAllocated,  // ROOT objects created for plots and images
+        kFilesWritten,
+        kBytesWritten,
+        nCounters
+    };
+
+    static const char *stageName(int stage) {
+        static const char *const names[nStages] = {"open", "build", "get_entry", "features", "pulses", "graph_fill", "labels",
+                                                   "raster", "document", "queue_wait", "encode"};
+        return names[stage];
+    }
+
+    static const char *counterName(int counter) {
+        static const char *const names[nCounters] = {"bytes_read", "bytes_decompressed", "events_loaded", "objects_allocated",
+                                                     "files_written", "bytes_written"};
+        return names[counter];
+    }
+
+    bool enabled = false; // Set before any worker starts
+
+    // Start profiling now; samples the RSS every rssIntervalMs if that is positive
+    void start(int rssIntervalMs) {
+        enabled = true;
+        origin = std::chrono::steady_clock::now();
+        nameThread("main");
+        if (rssIntervalMs > 0) sampler = std::thread(&Profiler::sampleRSS, this, rssIntervalMs);
+    }
+
+    // Stop the RSS sampler; the records stay for the report and the trace
+    void stop() {
+        if (sampler.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(samplerMutex);
+                stopping = true;
+            }
+            samplerWake.notify_all();
+            sampler.join();
+        }
+        enabled = false;
+    }
+
+    void count(Counter counter, Long64_t n = 1) {
+        if (enabled) counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Name the calling thread in the trace, e.g. "render 2"
+    void nameThread(const std::string &name) {
+        if (enabled) thread().name = name;
+    }
+
+    // Nanoseconds since start()
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    void record(Stage stage, int64_t start, int64_t end) {
+        thread().records.push_back(Record{start, end - start, (uint8_t)stage});
+    }
+
+    // Per-stage latency table and the counters
+    void report(std::ostream &out) {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        std::vector<StageTimes> stages(nStages);
+        for (const std::unique_ptr<ThreadRecords> &thread : threads) {
+            for (const Record &record : thread->records) stages[record.stage].us.push_back(record.duration / 1000.0);
+        }
+        out << "Profile over " << now() / 1e9 << " s on " << threads.size() << " threads:" << std::endl
+            << "  " << std::left << std::setw(12) << "stage" << std::right << std::setw(10) << "count" << std::setw(11) << "total_s"
+            << std::setw(11) << "mean_us" << std::setw(11) << "p50_us" << std::setw(11) << "p95_us" << std::setw(11) << "p99_us"
+            << std::setw(11) << "max_us" << std::endl;
+        for (int stage = 0; stage < nStages; stage++) {
+            if (!stages[stage].us.empty()) stages[stage].print(out, stageName(stage));
+        }
+        out << " ";
+        for (int counter = 0; counter < nCounters; counter++) out << " " << counterName(counter) << "=" << counters[counter];
+        out << std::endl;
+        if (!rssSamples.empty()) {
+            double peak = 0, sum = 0;
+            for (const RSSSample &sample : rssSamples) {
+                peak = std::max(peak, sample.mb);
+                sum += sample.mb;
+            }
+            out << "  RSS: " << rssSamples.size() << " samples, mean " << sum / rssSamples.size() << " MB, peak " << peak << " MB" << std::endl;
+        }
+    }
+
+    // Chrome trace event format: one complete event per scope, thread names, RSS and the final counters
+    bool writeTrace(const std::string &fileName) {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        std::ofstream out(fileName);
+        if (!out) {
+            std::cerr << "Error writing trace: " << fileName << std::endl;
+            return false;
+        }
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << std::endl;
+        const char *separator = "";
+        for (size_t tid = 0; tid < threads.size(); tid++) {
+            out << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << tid
+                << ", \"args\": {\"name\": \"" << threads[tid]->name << "\"}}";
+            separator = ",\n";
+            for (const Record &record : threads[tid]->records) {
+                out << separator << "{\"name\": \"" << stageName(record.stage) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+                    << ", \"ts\": " << record.start / 1000.0 << ", \"dur\": " << record.duration / 1000.0 << "}";
+            }
+        }
+        for (const RSSSample &sample : rssSamples) {
+            out << separator << "{\"name\": \"rss\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << sample.time / 1000.0
+                << ", \"args\": {\"MB\": " << sample.mb << "}}";
+            separator = ",\n";
+        }
+        out << separator << "{\"name\": \"counters\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << now() / 1000.0 << ", \"args\": {";
+        for (int counter = 0; counter < nCounters; counter++) {
+            out << (counter > 0 ? ", " : "") << "\"" << counterName(counter) << "\": " << counters[counter];
+        }
+        out << "}}" << std::endl << "]}" << std::endl;
+        out.close();
+        if (!out) {
+            std::cerr << "Error writing trace: " << fileName << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Record {
+        int64_t start;    // ns since start()
+        int64_t duration; // ns
+        uint8_t stage;
+    };
+
+    struct ThreadRecords {
+        std::string name;
+        std::vector<Record> records;
+    };
+
+    struct RSSSample {
+        int64_t time;
+        double mb;
+    };
+
+    // Records of the calling thread, registered on its first scope. They are owned by the profiler, so they
+    // outlive the worker and encoder threads.
+    ThreadRecords &thread() {
+        thread_local ThreadRecords *local = nullptr;
+        thread_local const Profiler *owner = nullptr;
+        if (!local || owner != this) {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            threads.emplace_back(new ThreadRecords());
+            local = threads.back().get();
+            local->name = "thread " + std::to_string(threads.size() - 1);
+            owner = this;
+        }
+        return *local;
+    }
+
+    void sampleRSS(int intervalMs) {
+        std::unique_lock<std::mutex> lock(samplerMutex);
+        while (!stopping) {
+            rssSamples.push_back(RSSSample{now(), currentRSSMB()});
+            samplerWake.wait_for(lock, std::chrono::milliseconds(intervalMs), [this]() { return stopping; });
+        }
+    }
+
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    std::atomic<Long64_t> counters[nCounters] = {};
+    std::vector<std::unique_ptr<ThreadRecords>> threads;
+    std::mutex threadsMutex;
+
+    std::thread sampler;
+    std::mutex samplerMutex;
+    std::condition_variable samplerWake;
+    bool stopping = false;
+    std::vector<RSSSample> rssSamples; // Written by the sampler until stop()
+};
+
+// The profiler of the process
+inline Profiler &profiler() {
+    static Profiler instance;
+    return instance;
+}
+
+// Times the enclosing block as one stage when profiling is enabled
+class ProfileScope {
+public:
+    explicit ProfileScope(Profiler::Stage stage) : stage(stage), active(profiler().enabled) {
+        if (active) start = profiler().now();
+    }
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope &operator=(const ProfileScope &) = delete;
+    ~ProfileScope() {
+        if (active) profiler().record(stage, start, profiler().now());
+    }
+
+private:
+    Profiler::Stage stage;
+    bool active;
+    int64_t start = 0;
+};
+
+#endif
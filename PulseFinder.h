@@ -0,0 +1,119 @@
+// Pulse finding on the waveform of every channel. A pulse starts where the samples rise to threshold above the
+// baseline (its foot reaches back to the last sample at the baseline) and ends where they fall below it again,
+// plus its falling tail. Piled-up pulses are separated by the first derivative: when the samples fall from a
+// maximum by at least minRise and then rise again by minRise, the pulse is split at the minimum. A pulse that
+// starts before the previous one has returned to the baseline is piled up as well. For each pulse the half-height
+// time of the leading edge, the amplitude and the baseline-subtracted charge are kept.
+// Most channels carry no pulse. They are rejected by the threshold search of the feature kernel (AVX2 for 45
+// samples), so only the channels with a pulse are walked sample by sample.
+#ifndef PULSEFINDER_H
+#define PULSEFINDER_H
+
+#include <vector>
+#include "WaveformFeatures.h"
+
+struct PulseFinderConfig {
+    double threshold = defaultFeatureThreshold; // ADC counts above the baseline that start a pulse
+    double minRise = defaultFeatureThreshold;   // Dip and rise (ADC counts) that separate piled-up pulses
+};
+
+const uint8_t pulsePileUp = 1; // The pulse overlaps a neighbouring pulse of its channel
+
+// Store the pulse on samples [start, end] with its maximum at peak; the leading edge rises from startLevel
+inline void addPulse(const Short_t *samples, int channel, int start, int peak, int end, double baseline, double startLevel,
+                     uint8_t flags, std::vector<Pulse> &pulses) {
+    Pulse pulse;
+    pulse.channel = channel;
+    pulse.startSample = start;
+    pulse.peakSample = peak;
+    pulse.endSample = end;
+    pulse.flags = flags;
+    pulse.amplitude = samples[peak] - baseline;
+
+    int sum = 0;
+    for (int k = start; k <= end; k++) sum += samples[k];
+    pulse.charge = sum - (end - start + 1) * baseline;
+
+    double halfHeight = startLevel + 0.5 * (samples[peak] - startLevel);
+    int k = start;
+    while (k < peak && samples[k] < halfHeight) k++;
+    pulse.time = interpolatedCrossing(samples, k, halfHeight);
+    pulses.push_back(pulse);
+}
+
+// Append the pulses of one channel (nSamples contiguous samples) to pulses
+template <int NSamples>
+inline void findChannelPulses(const Short_t *samples, int nSamples, int channel, const PulseFinderConfig &config, std::vector<Pulse> &pulses) {
+    if (NSamples > 0) nSamples = NSamples;
+    int baselineSum = 0;
+    for (int i = 0; i < nBaselineSamples; i++) baselineSum += samples[i];
+    double baseline = (double)baselineSum / nBaselineSamples;
+    int level = sampleLevel(baseline + config.threshold);
+    int k = firstSampleAtLeast<NSamples>(samples, nSamples, level);
+    if (k < 0) return;
+
+    size_t firstPulse = pulses.size();
+    int floor = 0; // First sample after the previous pulse
+    while (k >= 0) {
+        // Leading edge back to the baseline, or to the end of the previous pulse if it hasn't returned there
+        int start = k;
+        while (start > floor && samples[start - 1] > baseline) start--;
+        uint8_t flags = 0;
+        if (start == floor && pulses.size() > firstPulse && samples[start - 1] > baseline) {
+            flags = pulsePileUp;
+            pulses.back().flags |= pulsePileUp;
+        }
+        double startLevel = baseline;
+
+        // Walk the samples above threshold, splitting at a dip followed by a rise
+        int peak = k, valley = -1;
+        for (k++; k < nSamples && samples[k] >= level; k++) {
+            if (valley < 0) {
+                if (samples[k] > samples[peak]) peak = k;
+                else if (samples[k] < samples[k - 1]) valley = k;
+            } else if (samples[k] < samples[valley]) {
+                valley = k;
+            } else if (samples[peak] - samples[valley] >= config.minRise && samples[k] - samples[valley] >= config.minRise) {
+                addPulse(samples, channel, start, peak, valley - 1, baseline, startLevel, flags | pulsePileUp, pulses);
+                start = valley;
+                startLevel = samples[valley];
+                flags = pulsePileUp;
+                peak = k;
+                valley = -1;
+            } else if (samples[k] > samples[peak]) {
+                peak = k; // Noise on the top of the pulse
+                valley = -1;
+            }
+        }
+
+        // Falling tail down to the baseline
+        int end = k - 1;
+        while (end + 1 < nSamples && samples[end + 1] > baseline && samples[end + 1] <= samples[end]) end++;
+        addPulse(samples, channel, start, peak, end, baseline, startLevel, flags, pulses);
+
+        floor = end + 1;
+        int next = floor < nSamples ? firstSampleAtLeastScalar(samples + floor, nSamples - floor, level) : -1;
+        k = next < 0 ? -1 : floor + next;
+    }
+}
+
+template <int NSamples>
+inline void findEventPulsesFixed(const Short_t *adc, int nChannels, int nSamples, Long64_t channelStride, EventFeatures &features,
+                                 const PulseFinderConfig &config) {
+    features.pulses.clear();
+    features.firstPulse.resize(nChannels + 1); // Only allocates on the first event
+    for (int i = 0; i < nChannels; i++) {
+        features.firstPulse[i] = (int)features.pulses.size();
+        findChannelPulses<NSamples>(adc + i * channelStride, nSamples, i, config, features.pulses);
+    }
+    features.firstPulse[nChannels] = (int)features.pulses.size();
+}
+
+// Pulses of all channels of an event into features.pulses; the layout of adc is that of extractEventFeatures
+inline void findEventPulses(const Short_t *adc, int nChannels, int nSamples, Long64_t channelStride, EventFeatures &features,
+                            const PulseFinderConfig &config) {
+    if (nSamples == 45) findEventPulsesFixed<45>(adc, nChannels, nSamples, channelStride, features, config);
+    else findEventPulsesFixed<0>(adc, nChannels, nSamples, channelStride, features, config);
+}
+
+#endif
@@ -0,0 +1,264 @@
+// Pulses of every event of a file in a columnar sidecar next to the ROOT file (<file>.wpulse), for analysis
+// outside the plotting tools (e.g. numpy.fromfile). After the header the columns follow one after the other:
+//   int64   firstPulse[nEvents + 1]  the pulses of event e are firstPulse[e] up to firstPulse[e + 1]
+//   uint16  channel[nPulses]         detector channel, PMTs first, then SiPMs (as in the event index)
+//   uint8   startSample, peakSample, endSample, flags [nPulses] each
+//   float   time, amplitude, charge [nPulses] each
+// The pulses are found by workers on contiguous blocks of events, each into its own table; the tables are
+// concatenated in event order at the end, so the file doesn't depend on the number of workers.
+#ifndef PULSETABLE_H
+#define PULSETABLE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <sys/stat.h>
+#include <TStopwatch.h>
+#include "DetectorGeometry.h"
+#include "RunFiles.h"
+#include "WaveformReader.h"
+#include "WorkerPool.h"
+#include "PulseFinder.h"
+
+// Header of the sidecar file; the source file, geometry and finder settings are kept to detect a stale table
+struct PulseTableHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t nChannels;
+    uint32_t geometryHash;
+    int64_t nEvents;
+    int64_t nPulses;
+    int64_t sourceSize;
+    int64_t sourceMTime;
+    float threshold;
+    float minRise;
+};
+
+const uint32_t pulseTableVersion = 1;
+
+struct PulseTable {
+    Long64_t nEvents = 0;
+    std::vector<int64_t> firstPulse{0};
+    std::vector<uint16_t> channel;
+    std::vector<uint8_t> startSample, peakSample, endSample, flags;
+    std::vector<float> time, amplitude, charge;
+
+    Long64_t nPulses() const {
+        return (Long64_t)channel.size();
+    }
+
+    Long64_t nPileUp() const {
+        Long64_t n = 0;
+        for (uint8_t f : flags) n += (f & pulsePileUp) != 0;
+        return n;
+    }
+
+    // Append the next event from the pulses found in features, ordered by detector channel
+    void addEvent(const EventFeatures &features, const DetectorGeometry &geometry) {
+        for (int detectorChannel = 0; detectorChannel < geometry.nDetectorChannels(); detectorChannel++) {
+            int adcIndex = geometry.adcChannel(detectorChannel);
+            for (int i = features.firstPulse[adcIndex]; i < features.firstPulse[adcIndex + 1]; i++) {
+                const Pulse &pulse = features.pulses[i];
+                channel.push_back(detectorChannel);
+                startSample.push_back(pulse.startSample);
+                peakSample.push_back(pulse.peakSample);
+                endSample.push_back(pulse.endSample);
+                flags.push_back(pulse.flags);
+                time.push_back(pulse.time);
+                amplitude.push_back(pulse.amplitude);
+                charge.push_back(pulse.charge);
+            }
+        }
+        nEvents++;
+        firstPulse.push_back(nPulses());
+    }
+
+    // Append the events of another table
+    void append(const PulseTable &part) {
+        Long64_t offset = nPulses();
+        for (Long64_t event = 1; event <= part.nEvents; event++) firstPulse.push_back(offset + part.firstPulse[event]);
+        nEvents += part.nEvents;
+        channel.insert(channel.end(), part.channel.begin(), part.channel.end());
+        startSample.insert(startSample.end(), part.startSample.begin(), part.startSample.end());
+        peakSample.insert(peakSample.end(), part.peakSample.begin(), part.peakSample.end());
+        endSample.insert(endSample.end(), part.endSample.begin(), part.endSample.end());
+        flags.insert(flags.end(), part.flags.begin(), part.flags.end());
+        time.insert(time.end(), part.time.begin(), part.time.end());
+        amplitude.insert(amplitude.end(), part.amplitude.begin(), part.amplitude.end());
+        charge.insert(charge.end(), part.charge.begin(), part.charge.end());
+    }
+
+    // Find the pulses of all events with one pass over the file, splitting the entries into contiguous blocks per worker
+    bool build(const char *fileName, const DetectorGeometry &geometry, const PulseFinderConfig &config, int nWorkers) {
+        Long64_t n = 0;
+        {
+            WaveformReader reader;
+            if (!reader.open(fileName, geometry)) return false;
+            n = reader.nEntries;
+        }
+        if (nWorkers < 1) nWorkers = defaultWorkerCount();
+        if (nWorkers > n) nWorkers = n > 0 ? (int)n : 1;
+
+        std::vector<PulseTable> parts(nWorkers);
+        std::atomic<bool> ok(true);
+        runWorkers(nWorkers, [&](int worker) {
+            Long64_t first = n * worker / nWorkers;
+            Long64_t last = n * (worker + 1) / nWorkers - 1;
+            WaveformReader reader;
+            if (!reader.open(fileName, geometry)) {
+                ok = false;
+                return;
+            }
+            reader.setEntryRange(first, last);
+            EventFeatures features;
+            for (Long64_t EventID = first; EventID <= last; EventID++) {
+                if (!reader.load(EventID)) {
+                    ok = false;
+                    return;
+                }
+                reader.findPulses(features, config);
+                parts[worker].addEvent(features, geometry);
+            }
+        });
+        if (!ok) return false;
+
+        *this = PulseTable();
+        for (const PulseTable &part : parts) append(part);
+        return true;
+    }
+
+    // Write the table under a temporary name and rename it into place
+    bool write(const std::string &tableFileName, const struct stat &source, const DetectorGeometry &geometry, const PulseFinderConfig &config) const {
+        std::string partialFileName = tableFileName + ".partial";
+        std::ofstream out(partialFileName, std::ios::binary);
+        if (!out) {
+            std::cerr << "Error writing pulse table: " << tableFileName << std::endl;
+            return false;
+        }
+        PulseTableHeader header;
+        memcpy(header.magic, "WPLS", 4);
+        header.version = pulseTableVersion;
+        header.nChannels = geometry.nDetectorChannels();
+        header.geometryHash = geometry.hash();
+        header.nEvents = nEvents;
+        header.nPulses = nPulses();
+        header.sourceSize = source.st_size;
+        header.sourceMTime = source.st_mtime;
+        header.threshold = config.threshold;
+        header.minRise = config.minRise;
+        out.write((const char*)&header, sizeof(header));
+        out.write((const char*)firstPulse.data(), firstPulse.size() * sizeof(int64_t));
+        out.write((const char*)channel.data(), channel.size() * sizeof(uint16_t));
+        for (const std::vector<uint8_t> *column : {&startSample, &peakSample, &endSample, &flags}) {
+            out.write((const char*)column->data(), column->size());
+        }
+        for (const std::vector<float> *column : {&time, &amplitude, &charge}) {
+            out.write((const char*)column->data(), column->size() * sizeof(float));
+        }
+        out.close();
+        if (!out || rename(partialFileName.c_str(), tableFileName.c_str()) != 0) {
+            std::cerr << "Error writing pulse table: " << tableFileName << std::endl;
+            remove(partialFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Bytes of a table of nEvents and nPulses after the header: the event offsets and the pulse columns
+    static int64_t dataSize(int64_t nEvents, int64_t nPulses) {
+        return (nEvents + 1) * (int64_t)sizeof(int64_t) + nPulses * (int64_t)(sizeof(uint16_t) + 4 * sizeof(uint8_t) + 3 * sizeof(float));
+    }
+
+    // Read the table; fails quietly if it is missing, has another format, is older than the ROOT file,
+    // was built for another geometry or with other finder settings, or its size doesn't match its header
+    bool read(const std::string &tableFileName, const struct stat &source, const DetectorGeometry &geometry, const PulseFinderConfig &config) {
+        std::ifstream in(tableFileName, std::ios::binary);
+        struct stat table;
+        if (!in || stat(tableFileName.c_str(), &table) != 0) return false;
+        PulseTableHeader header;
+        if (!in.read((char*)&header, sizeof(header))) return false;
+        if (memcmp(header.magic, "WPLS", 4) != 0 || header.version != pulseTableVersion ||
+            header.nChannels != (uint32_t)geometry.nDetectorChannels() || header.geometryHash != geometry.hash() ||
+            header.sourceSize != (int64_t)source.st_size || header.sourceMTime != (int64_t)source.st_mtime ||
+            header.threshold != (float)config.threshold || header.minRise != (float)config.minRise) {
+            return false;
+        }
+
+        // Check the counts against the file size before allocating for them, so a truncated or corrupt table is rebuilt
+        int64_t size = (int64_t)table.st_size - (int64_t)sizeof(header);
+        int64_t pulseBytes = dataSize(0, 1) - dataSize(0, 0);
+        if (header.nEvents < 0 || header.nPulses < 0 || header.nEvents >= size / (int64_t)sizeof(int64_t) ||
+            header.nPulses > size / pulseBytes || dataSize(header.nEvents, header.nPulses) != size) {
+            return false;
+        }
+        nEvents = header.nEvents;
+        firstPulse.resize(nEvents + 1);
+        channel.resize(header.nPulses);
+        in.read((char*)firstPulse.data(), firstPulse.size() * sizeof(int64_t));
+        in.read((char*)channel.data(), channel.size() * sizeof(uint16_t));
+        for (std::vector<uint8_t> *column : {&startSample, &peakSample, &endSample, &flags}) {
+            column->resize(header.nPulses);
+            in.read((char*)column->data(), column->size());
+        }
+        for (std::vector<float> *column : {&time, &amplitude, &charge}) {
+            column->resize(header.nPulses);
+            in.read((char*)column->data(), column->size() * sizeof(float));
+        }
+        return (bool)in;
+    }
+};
+
+inline std::string pulseTableFileName(const char *fileName) {
+    return std::string(fileName) + ".wpulse";
+}
+
+// Load the pulse table of fileName, finding the pulses (and saving the table) first if it is missing or stale
+inline bool loadPulseTable(const char *fileName, const DetectorGeometry &geometry, const PulseFinderConfig &config, PulseTable &table,
+                           int nWorkers, bool &built) {
+    struct stat source;
+    if (stat(fileName, &source) != 0) {
+        std::cerr << "Error opening file: " << fileName << std::endl;
+        return false;
+    }
+
+    std::string tableFileName = pulseTableFileName(fileName);
+    built = false;
+    if (table.read(tableFileName, source, geometry, config)) return true;
+
+    std::cout << "Finding pulses, writing " << tableFileName << std::endl;
+    if (!table.build(fileName, geometry, config, nWorkers)) return false;
+    built = true;
+    table.write(tableFileName, source, geometry, config); // The table is still usable in memory if it can't be written
+    return true;
+}
+
+// Find the pulses of every file of a run (one file after the other, each split over all workers) and print the totals
+inline bool findRunPulses(const RunFiles &run, const DetectorGeometry &geometry, const PulseFinderConfig &config, int nWorkers) {
+    TStopwatch timer;
+    Long64_t nEvents = 0, nPulses = 0, nPileUp = 0, nBuilt = 0;
+    for (const std::string &file : run.fileNames) {
+        PulseTable table;
+        bool built = false;
+        if (!loadPulseTable(file.c_str(), geometry, config, table, nWorkers, built)) return false;
+        nEvents += table.nEvents;
+        nPulses += table.nPulses();
+        nPileUp += table.nPileUp();
+        if (built) nBuilt += table.nEvents;
+    }
+    timer.Stop();
+
+    std::cout << "Pulses: " << nPulses << " in " << nEvents << " events (" << (nEvents > 0 ? (double)nPulses / nEvents : 0)
+              << " per event), " << (nPulses > 0 ? 100.0 * nPileUp / nPulses : 0) << "% piled up" << std::endl;
+    if (nBuilt > 0) {
+        double seconds = timer.RealTime();
+        std::cout << "Searched " << nBuilt << " events in " << seconds << " s (" << (seconds > 0 ? nBuilt / seconds : 0) << " events/s)" << std::endl;
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,202 @@
+// Small native rasterizer for bulk thumbnails (--output raster), independent of ROOT: an 8-bit image with a fixed
+// palette, lines, rectangles and text in a 3x5 pixel font, and a PNG encoder on zlib. Nothing here touches global
+// state, so every render worker draws into its own image and every encoder thread has its own deflate stream.
+// The plots only use a handful of colors, so the PNG has a 4-bit palette and holds an eighth of the bytes of an RGBA
+// one; the rows are stored unfiltered with run-length deflate, which suits their long runs of background.
+#ifndef RASTERIMAGE_H
+#define RASTERIMAGE_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cctype>
+#include <zlib.h>
+
+struct RasterImage {
+    enum Color {
+        kWhite,
+        kBlack,
+        kGray,
+        kBlue,
+        kRed,
+        kGreen,
+        kMagenta,
+        nColors
+    };
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> pixels; // Palette index per pixel, row by row
+
+    static const uint8_t *palette() {
+        static const uint8_t rgb[nColors * 3] = {255, 255, 255, 0, 0, 0, 136, 136, 136, 0, 0, 255,
+                                                 255, 0, 0, 0, 128, 0, 192, 0, 192};
+        return rgb;
+    }
+
+    // Size the image, reusing the buffer when it is large enough, and clear it to white
+    void reset(int newWidth, int newHeight) {
+        width = newWidth;
+        height = newHeight;
+        pixels.assign((size_t)width * height, kWhite);
+    }
+
+    void set(int x, int y, uint8_t color) {
+        if (x >= 0 && x < width && y >= 0 && y < height) pixels[(size_t)y * width + x] = color;
+    }
+
+    // Outline of the rectangle with corners (x0, y0) and (x1, y1)
+    void rectangle(int x0, int y0, int x1, int y1, uint8_t color) {
+        for (int x = x0; x <= x1; x++) {
+            set(x, y0, color);
+            set(x, y1, color);
+        }
+        for (int y = y0; y <= y1; y++) {
+            set(x0, y, color);
+            set(x1, y, color);
+        }
+    }
+
+    // Bresenham line, both end points included
+    void line(int x0, int y0, int x1, int y1, uint8_t color) {
+        int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+        int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+        int error = dx + dy;
+        while (true) {
+            set(x0, y0, color);
+            if (x0 == x1 && y0 == y1) break;
+            int e2 = 2 * error;
+            if (e2 >= dy) {
+                error += dy;
+                x0 += sx;
+            }
+            if (e2 <= dx) {
+                error += dx;
+                y0 += sy;
+            }
+        }
+    }
+
+    // Text with its top-left corner at (x, y), each font pixel drawn as scale x scale pixels. Letters are drawn
+    // upper case; returns the x after the text.
+    int text(int x, int y, const std::string &text, uint8_t color, int scale = 1) {
+        for (char c : text) {
+            uint16_t glyph = fontGlyph(c);
+            for (int row = 0; row < 5; row++) {
+                for (int col = 0; col < 3; col++) {
+                    if (!(glyph & (1 << (14 - 3 * row - col)))) continue;
+                    for (int i = 0; i < scale * scale; i++) set(x + col * scale + i % scale, y + row * scale + i / scale, color);
+                }
+            }
+            x += 4 * scale;
+        }
+        return x;
+    }
+
+    // Width of a text in pixels
+    static int textWidth(const std::string &text, int scale = 1) {
+        return text.empty() ? 0 : (4 * (int)text.size() - 1) * scale;
+    }
+
+private:
+    // 3x5 glyphs of ASCII 32-95, five rows of three bits from the top left; '?' for anything else
+    static uint16_t fontGlyph(char c) {
+        static const uint16_t glyphs[64] = {
+            0x0000, 0x7282, 0x7282, 0x7282, 0x7282, 0x52a5, 0x7282, 0x7282,
+            0x1491, 0x4494, 0x7282, 0x05d0, 0x0014, 0x01c0, 0x0002, 0x12a4,
+            0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef, 0x7249,
+            0x7bef, 0x7bcf, 0x0410, 0x7282, 0x7282, 0x0e38, 0x7282, 0x7282,
+            0x7282, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b,
+            0x5bed, 0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a,
+            0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492, 0x5b6f, 0x5b6a, 0x5bfd,
+            0x5aad, 0x5a92, 0x72a7, 0x7282, 0x7282, 0x7282, 0x7282, 0x7282,
+        };
+        int code = toupper((unsigned char)c);
+        return code >= 32 && code < 96 ? glyphs[code - 32] : glyphs['?' - 32];
+    }
+};
+
+// PNG encoder with a reusable deflate stream and row buffer; one per thread
+class PNGEncoder {
+public:
+    PNGEncoder() {}
+    PNGEncoder(const PNGEncoder &) = delete;
+    PNGEncoder &operator=(const PNGEncoder &) = delete;
+    ~PNGEncoder() {
+        if (initialized) deflateEnd(&stream);
+    }
+
+    // Encode the image as a 4-bit palette PNG into png; returns false if deflate fails
+    bool encode(const RasterImage &image, std::string &png) {
+        if (!initialized) {
+            stream = z_stream();
+            if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, 15, 8, Z_RLE) != Z_OK) return false;
+            initialized = true;
+        } else {
+            deflateReset(&stream);
+        }
+
+        // Every row starts with its filter type, 0 (none), followed by two pixels per byte, the first in the high bits
+        size_t rowBytes = (size_t)(image.width + 1) / 2 + 1;
+        rows.resize(rowBytes * image.height);
+        for (int y = 0; y < image.height; y++) {
+            uint8_t *row = &rows[y * rowBytes];
+            const uint8_t *pixel = &image.pixels[(size_t)y * image.width];
+            row[0] = 0;
+            for (int x = 0; x + 1 < image.width; x += 2) row[1 + x / 2] = (uint8_t)(pixel[x] << 4 | pixel[x + 1]);
+            if (image.width % 2) row[rowBytes - 1] = (uint8_t)(pixel[image.width - 1] << 4);
+        }
+        compressed.resize(deflateBound(&stream, rows.size()));
+        stream.next_in = rows.data();
+        stream.avail_in = (uInt)rows.size();
+        stream.next_out = compressed.data();
+        stream.avail_out = (uInt)compressed.size();
+        if (deflate(&stream, Z_FINISH) != Z_STREAM_END) return false;
+        size_t compressedSize = compressed.size() - stream.avail_out;
+
+        png.assign("\x89PNG\r\n\x1a\n", 8);
+        uint8_t header[13];
+        putUInt32(header, image.width);
+        putUInt32(header + 4, image.height);
+        header[8] = 4;  // Bit depth
+        header[9] = 3;  // Palette color
+        header[10] = 0; // Deflate
+        header[11] = 0; // Adaptive filtering
+        header[12] = 0; // No interlace
+        appendChunk(png, "IHDR", header, sizeof(header));
+        appendChunk(png, "PLTE", RasterImage::palette(), RasterImage::nColors * 3);
+        appendChunk(png, "IDAT", compressed.data(), compressedSize);
+        appendChunk(png, "IEND", nullptr, 0);
+        return true;
+    }
+
+private:
+    static void putUInt32(uint8_t *out, uint32_t value) {
+        out[0] = value >> 24;
+        out[1] = value >> 16;
+        out[2] = value >> 8;
+        out[3] = value;
+    }
+
+    // Length, type, data and the CRC of type and data
+    static void appendChunk(std::string &png, const char *type, const uint8_t *data, size_t size) {
+        uint8_t word[4];
+        putUInt32(word, (uint32_t)size);
+        png.append((const char*)word, 4);
+        png.append(type, 4);
+        if (size > 0) png.append((const char*)data, size);
+        uLong crc = crc32(0, (const Bytef*)type, 4);
+        if (size > 0) crc = crc32(crc, data, (uInt)size);
+        putUInt32(word, (uint32_t)crc);
+        png.append((const char*)word, 4);
+    }
+
+    z_stream stream;
+    bool initialized = false;
+    std::vector<uint8_t> rows;       // Filtered rows, the deflate input
+    std::vector<uint8_t> compressed; // Deflate output
+};
+
+#endif
@@ -0,0 +1,138 @@
+// A run split over several ROOT files, addressed by run-global EventIDs: the events of the files are numbered
+// one after the other, in the order the files are given. The files of a run are given as
+//   run42_003.root              a single file
+//   "run42_*.root"              a glob (quoted so the tool expands it), matches in name order
+//   a.root,b.root,c.root        a comma-separated list, each item may be a glob
+//   @files.txt                  a text file with one file (or glob) per line, # starts a comment
+// Sidecars (event index, waveform cache) stay per file; WaveformReader maps run-global EventIDs to a file
+// and its local entry.
+#ifndef RUNFILES_H
+#define RUNFILES_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <glob.h>
+#include <TFile.h>
+#include <TTree.h>
+#include "WorkerPool.h"
+
+struct RunFiles {
+    std::vector<std::string> fileNames;
+    std::vector<Long64_t> firstEntry; // Run-global EventID of the first event of each file, plus the total at the end
+
+    int nFiles() const {
+        return (int)fileNames.size();
+    }
+
+    Long64_t nEntries() const {
+        return firstEntry.empty() ? 0 : firstEntry.back();
+    }
+
+    Long64_t fileEntries(int file) const {
+        return firstEntry[file + 1] - firstEntry[file];
+    }
+
+    // File holding a run-global EventID (which must be in range)
+    int fileOf(Long64_t EventID) const {
+        return (int)(std::upper_bound(firstEntry.begin(), firstEntry.end() - 1, EventID) - firstEntry.begin()) - 1;
+    }
+
+    // Name used for the output files: the file itself, or the first file and the number of further files
+    std::string label() const {
+        if (fileNames.size() == 1) return fileNames[0];
+        return fileNames[0] + "+" + std::to_string(fileNames.size() - 1);
+    }
+};
+
+// Add the files matching one item of a file spec (a file name or a glob)
+inline bool expandFileItem(const std::string &item, std::vector<std::string> &fileNames) {
+    if (item.find_first_of("*?[") == std::string::npos) {
+        fileNames.push_back(item);
+        return true;
+    }
+    glob_t matches;
+    int status = glob(item.c_str(), 0, nullptr, &matches); // Sorted by name
+    if (status == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; i++) fileNames.push_back(matches.gl_pathv[i]);
+    }
+    globfree(&matches);
+    if (status != 0) {
+        std::cerr << "Error: no files match " << item << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Expand a file spec (see above) into the list of files of the run
+inline bool expandFileSpec(const char *spec, std::vector<std::string> &fileNames) {
+    fileNames.clear();
+    std::vector<std::string> items;
+    if (spec[0] == '@') {
+        std::ifstream in(spec + 1);
+        if (!in) {
+            std::cerr << "Error opening file list: " << spec + 1 << std::endl;
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t comment = line.find('#');
+            if (comment != std::string::npos) line.erase(comment);
+            std::istringstream words(line);
+            std::string item;
+            if (words >> item) items.push_back(item);
+        }
+    } else {
+        std::istringstream list(spec);
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            if (!item.empty()) items.push_back(item);
+        }
+    }
+    for (const std::string &item : items) {
+        if (!expandFileItem(item, fileNames)) return false;
+    }
+    if (fileNames.empty()) {
+        std::cerr << "Error: no input files in " << spec << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Expand the file spec and number the events of the run; the files are opened in parallel, one worker per file
+inline bool openRunFiles(const char *spec, int nWorkers, RunFiles &run) {
+    if (!expandFileSpec(spec, run.fileNames)) return false;
+    int nFiles = run.nFiles();
+    std::vector<Long64_t> entries(nFiles, 0);
+
+    if (nWorkers < 1) nWorkers = defaultWorkerCount();
+    if (nWorkers > nFiles) nWorkers = nFiles;
+    std::atomic<int> nextFile(0);
+    std::atomic<bool> ok(true);
+    runWorkers(nWorkers, [&](int) {
+        for (int file = nextFile++; file < nFiles; file = nextFile++) {
+            TFile *input = TFile::Open(run.fileNames[file].c_str());
+            TTree *tree = input && !input->IsZombie() ? (TTree*)input->Get("tree") : nullptr;
+            if (tree) {
+                entries[file] = tree->GetEntries();
+            } else {
+                std::lock_guard<std::mutex> lock(consoleMutex());
+                std::cerr << "Error opening file: " << run.fileNames[file] << std::endl;
+                ok = false;
+            }
+            delete input;
+        }
+    });
+    if (!ok) return false;
+
+    run.firstEntry.assign(1, 0);
+    for (Long64_t n : entries) run.firstEntry.push_back(run.firstEntry.back() + n);
+    if (nFiles > 1) std::cout << "Run of " << nFiles << " files with " << run.nEntries() << " events" << std::endl;
+    return true;
+}
+
+#endif
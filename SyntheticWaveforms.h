@@ -0,0 +1,120 @@
+// Generator of synthetic waveform files in the DAQ schema, for benchmarking without detector data:
+// a "tree" with adcVal[channels][samples]/S, area[channels]/D and baselineMean[channels]/D, shaped by the detector
+// geometry (adcVal[23][45] for the standard geometry). Every channel gets a baseline with Gaussian noise and, with
+// probability occupancy, one pulse of the chosen shape at a random time.
+#ifndef SYNTHETICWAVEFORMS_H
+#define SYNTHETICWAVEFORMS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstdlib>
+#include <TFile.h>
+#include <TTree.h>
+#include <TRandom3.h>
+#include <TString.h>
+#include <Compression.h>
+#include "DetectorGeometry.h"
+#include "WaveformFeatures.h"
+
+struct SyntheticConfig {
+    Long64_t nEvents = 10000;
+    std::string pulse = "exp"; // exp (fast rise, exponential decay), gauss or square
+    double amplitude = 1500;   // Mean pulse height in ADC counts (exponentially distributed)
+    double width = 48;         // Decay time (exp), sigma (gauss) or length (square) in ns
+    double occupancy = 0.5;    // Fraction of channels with a pulse
+    double baseline = 200;     // Mean baseline in ADC counts
+    double noise = 3;          // Gaussian noise sigma in ADC counts
+    int compression = -1;      // ROOT compression settings (algorithm * 100 + level), -1 for the ROOT default
+    unsigned seed = 4357;
+};
+
+// Parse a compression spec, "none", "zlib", "lzma", "lz4" or "zstd" with an optional ":level", into ROOT settings
+inline bool parseCompression(const std::string &spec, int &settings) {
+    std::string algorithm = spec.substr(0, spec.find(':'));
+    int level = spec.find(':') == std::string::npos ? 4 : atoi(spec.c_str() + spec.find(':') + 1);
+    if (algorithm == "none") {
+        settings = 0;
+        return true;
+    }
+    int code = algorithm == "zlib" ? ROOT::RCompressionSetting::EAlgorithm::kZLIB :
+               algorithm == "lzma" ? ROOT::RCompressionSetting::EAlgorithm::kLZMA :
+               algorithm == "lz4"  ? ROOT::RCompressionSetting::EAlgorithm::kLZ4 :
+               algorithm == "zstd" ? ROOT::RCompressionSetting::EAlgorithm::kZSTD : -1;
+    if (code < 0 || level < 1 || level > 9) {
+        std::cerr << "Error: unknown compression '" << spec << "' (none, zlib, lzma, lz4 or zstd, with :1-9)" << std::endl;
+        return false;
+    }
+    settings = code * 100 + level;
+    return true;
+}
+
+// Pulse shape at time t (ns) after the pulse start, with a maximum of at most 1
+inline double pulseShape(const std::string &pulse, double t, double width) {
+    if (pulse == "gauss") {
+        double x = (t - 2 * width) / width;
+        return exp(-0.5 * x * x);
+    }
+    if (pulse == "square") return t >= 0 && t < width ? 1 : 0;
+    if (t < 0) return 0;
+    return (1 - exp(-t / 8.0)) * exp(-t / width); // 8 ns rise
+}
+
+// Write nEvents synthetic events to fileName
+inline bool generateSyntheticFile(const char *fileName, const DetectorGeometry &geometry, const SyntheticConfig &config) {
+    if (config.pulse != "exp" && config.pulse != "gauss" && config.pulse != "square") {
+        std::cerr << "Error: unknown pulse shape '" << config.pulse << "' (exp, gauss or square)" << std::endl;
+        return false;
+    }
+    TFile *file = TFile::Open(fileName, "RECREATE", "Synthetic waveforms", config.compression);
+    if (!file || file->IsZombie()) {
+        std::cerr << "Error creating file: " << fileName << std::endl;
+        delete file;
+        return false;
+    }
+
+    int nChannels = geometry.nChannels;
+    int nSamples = geometry.nSamples;
+    std::vector<Short_t> adcVal(nChannels * nSamples);
+    std::vector<Double_t> area(nChannels), baselineMean(nChannels);
+
+    TTree *tree = new TTree("tree", "Synthetic waveforms");
+    tree->Branch("adcVal", adcVal.data(), Form("adcVal[%d][%d]/S", nChannels, nSamples));
+    tree->Branch("area", area.data(), Form("area[%d]/D", nChannels));
+    tree->Branch("baselineMean", baselineMean.data(), Form("baselineMean[%d]/D", nChannels));
+
+    // Pulses start in the first two thirds of the window so most of the pulse is recorded
+    TRandom3 random(config.seed);
+    double window = geometry.timeWindow();
+    for (Long64_t event = 0; event < config.nEvents; event++) {
+        for (int channel = 0; channel < nChannels; channel++) {
+            double baseline = config.baseline + random.Gaus(0, 5); // Per-channel pedestal spread
+            bool hasPulse = random.Uniform() < config.occupancy;
+            double height = hasPulse ? random.Exp(config.amplitude) : 0;
+            double start = random.Uniform(sampleTime(nBaselineSamples), window * 2 / 3);
+
+            Short_t *samples = &adcVal[channel * nSamples];
+            double sum = 0;
+            for (int k = 0; k < nSamples; k++) {
+                double value = baseline + random.Gaus(0, config.noise) + height * pulseShape(config.pulse, sampleTime(k) - start, config.width);
+                samples[k] = (Short_t)std::max(-32768.0, std::min(32767.0, std::round(value)));
+                sum += samples[k];
+            }
+            double mean = 0;
+            for (int k = 0; k < nBaselineSamples; k++) mean += samples[k];
+            mean /= nBaselineSamples;
+            baselineMean[channel] = mean;
+            area[channel] = sum - nSamples * mean;
+        }
+        tree->Fill();
+    }
+
+    tree->Write();
+    file->Close();
+    delete file;
+    return true;
+}
+
+#endif
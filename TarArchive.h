@@ -0,0 +1,120 @@
+// Writer of uncompressed POSIX (ustar) tar archives, readable with tar -xf. Members are appended one after the
+// other, so a batch of small plots becomes one sequentially written file instead of one file (and inode) each.
+// Names that don't fit the ustar header are stored in a pax extended header, as GNU tar and bsdtar do.
+#ifndef TARARCHIVE_H
+#define TARARCHIVE_H
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+class TarArchive {
+public:
+    static const int blockSize = 512;
+    static const int trailerSize = 2 * blockSize; // Empty blocks that end the archive, written by close()
+
+    TarArchive() {}
+    TarArchive(const TarArchive &) = delete;
+    TarArchive &operator=(const TarArchive &) = delete;
+    ~TarArchive() { close(); }
+
+    bool open(const std::string &fileName) {
+        close();
+        out = fopen(fileName.c_str(), "wb");
+        if (!out) {
+            std::cerr << "Error creating archive: " << fileName << std::endl;
+            return false;
+        }
+        failed = false;
+        return true;
+    }
+
+    bool isOpen() const {
+        return out != nullptr;
+    }
+
+    // Append a regular file; returns the bytes added to the archive, 0 on error
+    size_t add(const std::string &name, const char *data, size_t size) {
+        if (!out) return 0;
+        size_t extendedBytes = 0;
+        char header[blockSize] = {};
+        if (!setName(header, name)) {
+            // The name only fits into a pax extended header ahead of the member, the ustar name field gets its end
+            std::string record = " path=" + name + "\n";
+            size_t length = record.size() + 1;
+            while (std::to_string(length).size() + record.size() != length) length++;
+            record = std::to_string(length) + record;
+            extendedBytes = addEntry("PaxHeader", 'x', record.data(), record.size(), header);
+            if (extendedBytes == 0) return 0;
+            memset(header, 0, blockSize);
+            std::string end = name.substr(name.size() - 99);
+            memcpy(header, end.data(), end.size());
+        }
+        size_t bytes = addEntry(nullptr, '0', data, size, header);
+        return bytes == 0 ? 0 : extendedBytes + bytes;
+    }
+
+    // Write the two empty blocks that end the archive and close it; returns false if any write failed
+    bool close() {
+        if (!out) return !failed;
+        static const char zeros[trailerSize] = {};
+        if (fwrite(zeros, 1, trailerSize, out) != trailerSize) failed = true;
+        if (fclose(out) != 0) failed = true;
+        out = nullptr;
+        return !failed;
+    }
+
+private:
+    // Write a header of the given type (name already set in header unless given) and the data, padded to whole blocks
+    size_t addEntry(const char *name, char type, const char *data, size_t size, char *header) {
+        if (name) {
+            memset(header, 0, blockSize);
+            memcpy(header, name, strlen(name));
+        }
+        snprintf(header + 100, 8, "%07o", 0644);                          // mode
+        snprintf(header + 108, 8, "%07o", 0);                             // uid
+        snprintf(header + 116, 8, "%07o", 0);                             // gid
+        snprintf(header + 124, 12, "%011llo", (unsigned long long)size);  // size
+        snprintf(header + 136, 12, "%011llo", (unsigned long long)time(nullptr) & 077777777777ULL); // mtime
+        header[156] = type;
+        memcpy(header + 257, "ustar", 6);
+        memcpy(header + 263, "00", 2);
+
+        // The checksum is computed with its own field filled with spaces
+        memset(header + 148, ' ', 8);
+        unsigned int checksum = 0;
+        for (int i = 0; i < blockSize; i++) checksum += (unsigned char)header[i];
+        snprintf(header + 148, 8, "%06o", checksum);
+        header[155] = ' ';
+
+        size_t padding = (blockSize - size % blockSize) % blockSize;
+        static const char zeros[blockSize] = {};
+        if (fwrite(header, 1, blockSize, out) != blockSize || fwrite(data, 1, size, out) != size ||
+            fwrite(zeros, 1, padding, out) != padding) {
+            failed = true;
+            return 0;
+        }
+        return blockSize + size + padding;
+    }
+
+    // Names longer than 100 characters are split at a '/' into the 155 character prefix field and the name field;
+    // returns false if the name doesn't fit that way
+    static bool setName(char *header, const std::string &name) {
+        size_t split = 0;
+        if (name.size() > 100) {
+            split = name.find('/', name.size() - 101);
+            if (split == std::string::npos || split > 155) return false;
+            memcpy(header + 345, name.data(), split);
+            split++;
+        }
+        memcpy(header, name.data() + split, name.size() - split);
+        return true;
+    }
+
+    FILE *out = nullptr;
+    bool failed = false;
+};
+
+#endif
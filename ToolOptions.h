@@ -0,0 +1,134 @@
+// Command-line options shared by the plotting tools
+#ifndef TOOLOPTIONS_H
+#define TOOLOPTIONS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cctype>
+#include "DetectorGeometry.h"
+#include "OutputLayout.h"
+
+struct ToolOptions {
+    int nWorkers = 0;                // -j: worker threads, 0 for one per hardware thread
+    const char *selection = nullptr; // --select: predicate resolved against the event index
+    const char *classRules = nullptr; // --classify: rules file of named event classes (EventClassifier.h)
+    const char *eventClass = nullptr; // --class: only events of this class of the --classify rules
+    bool buildIndex = false;         // --build-index: (re)build the event index before selecting
+    bool buildCache = false;         // --build-cache: (re)build the memory-mapped waveform cache
+    bool findPulses = false;         // --find-pulses: write the pulses of every event to the <file>.wpulse table
+    bool pulses = false;             // --pulses: mark the pulses found on the plots
+    double pulseThreshold = 20;      // --pulse-threshold: ADC counts above baseline that start a pulse
+    bool calibrate = false;          // --calibrate: (re)compute the <file>.wcal calibration tables (Calibration.h)
+    bool calibrated = false;         // --calibrated: plot the baseline-subtracted signal in photoelectrons
+    const char *calibrationFile = nullptr; // --calibration: one calibration table for all files of the run
+    bool summary = false;            // --summary: one persistence/mean/RMS chart of all selected events
+    const char *serveSocket = nullptr; // --serve: render events on request over this Unix domain socket
+    bool follow = false;             // --follow: watch a file the DAQ is writing and redraw as events arrive
+    int followInterval = 500;        // --follow-interval: minimum time between redraws in ms
+    const char *output = "png";      // --output: png, thumb, raster, svg, json, pdf or root (PlotOutput.h)
+    const char *outputDir = defaultOutputDirectory; // --output-dir: root directory of all output files (OutputLayout.h)
+    const char *shard = "none";      // --shard: none, run or a number of events per subdirectory
+    bool pack = false;               // --pack: one tar archive per batch instead of one file per plot
+    bool profile = false;            // --profile: per-stage latency percentiles and counters of the run (Profiler.h)
+    const char *traceFile = nullptr; // --trace: Chrome trace JSON of every timed stage
+    int profileRSS = 0;              // --profile-rss: RSS sampling interval in ms while profiling, 0 for none
+    const char *geometry = defaultGeometryName; // --geometry: builtin detector geometry name or geometry file
+    std::vector<const char*> args;   // Positional arguments
+};
+
+inline void printToolUsage(const char *program) {
+    std::cerr << "Usage: " << program << " [options] <root_files> [EventID|first-last|id,id,...|@event_list.txt]" << std::endl
+              << "  <root_files>          a file, a glob (\"run_*.root\"), a comma-separated list or @file_list.txt; EventIDs count across the files" << std::endl
+              << "  -j <workers>          number of worker threads (default: one per hardware thread)" << std::endl
+              << "  --select <predicate>  only events matching e.g. \"total PMT area > 5000\" or \"SiPM 3 peak > 400\"" << std::endl
+              << "  --classify <rules>    sort all events into the classes of a rules file (\"name: predicate\" lines) and save an event list per class" << std::endl
+              << "  --class <name>        only events of this class of the --classify rules" << std::endl
+              << "  --build-index         rebuild the <root_file>.widx event index" << std::endl
+              << "  --build-cache         rebuild the <root_file>.wcache columnar waveform cache, used automatically when present" << std::endl
+              << "  --find-pulses         find the pulses of every event, with pile-up separation, into the <root_file>.wpulse table" << std::endl
+              << "  --pulses              mark the pulses found (and piled-up ones) on the plots" << std::endl
+              << "  --pulse-threshold <adc> ADC counts above baseline that start a pulse, and dip that separates pile-up (default: 20)" << std::endl
+              << "  --calibrate           recompute the per-channel baseline, noise and gain of every file into <root_file>.wcal" << std::endl
+              << "  --calibrated          plot the baseline-subtracted signal in photoelectrons, calibrating files without a table" << std::endl
+              << "  --calibration <table> plot calibrated with this .wcal table for every file (e.g. of an LED run)" << std::endl
+              << "  --summary             persistence, mean and RMS waveforms of all selected events in one chart" << std::endl
+              << "  --serve <socket>      keep the file open and render events requested on a Unix domain socket" << std::endl
+              << "  --follow              watch a file that is being written and redraw the newest event and a running summary" << std::endl
+              << "  --follow-interval <ms> minimum time between redraws in follow mode (default: 500)" << std::endl
+              << "  --output <format>     png (default), thumb, raster, svg, json, pdf (one file per run) or root (one file per run)" << std::endl
+              << "  --output-dir <dir>    root directory of the output files, created if missing (default: " << defaultOutputDirectory << ")" << std::endl
+              << "  --shard <none|run|N>  one subdirectory per run, and with N one per block of N events in it (default: none)" << std::endl
+              << "  --pack                write the plots of a run into one tar archive instead of one file each" << std::endl
+              << "  --profile             print the time per stage (open, GetEntry, graph fill, labels, raster, encode, ...) with percentiles" << std::endl
+              << "  --trace <file.json>   write every timed stage of every thread as a Chrome trace (chrome://tracing, Perfetto)" << std::endl
+              << "  --profile-rss <ms>    sample the resident set size at this interval while profiling or tracing" << std::endl
+              << "  --geometry <name|file> detector geometry: a builtin name or a geometry file (default: " << defaultGeometryName << ")" << std::endl;
+}
+
+// Parse argv into options; returns false (after printing the usage) on an unknown or incomplete option
+inline bool parseToolOptions(int argc, char *argv[], ToolOptions &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-j" && hasValue) {
+            options.nWorkers = atoi(argv[++i]);
+        } else if (arg == "--select" && hasValue) {
+            options.selection = argv[++i];
+        } else if (arg == "--classify" && hasValue) {
+            options.classRules = argv[++i];
+        } else if (arg == "--class" && hasValue) {
+            options.eventClass = argv[++i];
+        } else if (arg == "--build-index") {
+            options.buildIndex = true;
+        } else if (arg == "--build-cache") {
+            options.buildCache = true;
+        } else if (arg == "--find-pulses") {
+            options.findPulses = true;
+        } else if (arg == "--pulses") {
+            options.pulses = true;
+        } else if (arg == "--pulse-threshold" && hasValue) {
+            options.pulseThreshold = atof(argv[++i]);
+        } else if (arg == "--calibrate") {
+            options.calibrate = true;
+        } else if (arg == "--calibrated") {
+            options.calibrated = true;
+        } else if (arg == "--calibration" && hasValue) {
+            options.calibrationFile = argv[++i];
+            options.calibrated = true;
+        } else if (arg == "--summary") {
+            options.summary = true;
+        } else if (arg == "--serve" && hasValue) {
+            options.serveSocket = argv[++i];
+        } else if (arg == "--follow") {
+            options.follow = true;
+        } else if (arg == "--follow-interval" && hasValue) {
+            options.followInterval = atoi(argv[++i]);
+        } else if (arg == "--output" && hasValue) {
+            options.output = argv[++i];
+        } else if (arg == "--output-dir" && hasValue) {
+            options.outputDir = argv[++i];
+        } else if (arg == "--shard" && hasValue) {
+            options.shard = argv[++i];
+        } else if (arg == "--pack") {
+            options.pack = true;
+        } else if (arg == "--profile") {
+            options.profile = true;
+        } else if (arg == "--trace" && hasValue) {
+            options.traceFile = argv[++i];
+        } else if (arg == "--profile-rss" && hasValue) {
+            options.profileRSS = atoi(argv[++i]);
+        } else if (arg == "--geometry" && hasValue) {
+            options.geometry = argv[++i];
+        } else if (arg.size() > 1 && arg[0] == '-' && !isdigit((unsigned char)arg[1])) {
+            printToolUsage(argv[0]);
+            return false;
+        } else {
+            options.args.push_back(argv[i]);
+        }
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,166 @@
+// Uncompressed columnar cache of a run (<file>.wcache), read through mmap without copies.
+// The file holds a header and three page-aligned sections:
+//   adcVal        int16 [channel][event][sample]  (channel-major: a channel of the whole run is contiguous)
+//   area          double [event][channel]
+//   baselineMean  double [event][channel]
+// Loading an event is only a pointer offset, and full-run scans read at memory bandwidth instead of
+// decompression speed. The cache is built with WaveformCacheBuilder.h and used by WaveformReader whenever
+// it is present and was built from the current version of the ROOT file.
+#ifndef WAVEFORMCACHE_H
+#define WAVEFORMCACHE_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Rtypes.h"
+
+struct WaveformCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t nChannels;
+    uint32_t nSamples;
+    int64_t nEvents;
+    int64_t sourceSize;  // Size and modification time of the ROOT file the cache was built from
+    int64_t sourceMTime;
+    uint64_t samplesOffset; // Byte offsets of the sections
+    uint64_t areaOffset;
+    uint64_t baselineMeanOffset;
+    uint64_t fileSize;
+};
+
+const uint32_t waveformCacheVersion = 1;
+const uint64_t waveformCacheAlignment = 4096; // Sections start on a page
+
+inline std::string waveformCacheFileName(const char *fileName) {
+    return std::string(fileName) + ".wcache";
+}
+
+inline uint64_t alignCacheOffset(uint64_t offset) {
+    return (offset + waveformCacheAlignment - 1) / waveformCacheAlignment * waveformCacheAlignment;
+}
+
+// Header of a cache for nEvents events of nChannels x nSamples, with the section offsets filled in
+inline WaveformCacheHeader makeWaveformCacheHeader(int nChannels, int nSamples, Long64_t nEvents, const struct stat &source) {
+    WaveformCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "WCCH", 4);
+    header.version = waveformCacheVersion;
+    header.nChannels = nChannels;
+    header.nSamples = nSamples;
+    header.nEvents = nEvents;
+    header.sourceSize = source.st_size;
+    header.sourceMTime = source.st_mtime;
+    header.samplesOffset = alignCacheOffset(sizeof(header));
+    header.areaOffset = alignCacheOffset(header.samplesOffset + (uint64_t)nChannels * nEvents * nSamples * sizeof(Short_t));
+    header.baselineMeanOffset = alignCacheOffset(header.areaOffset + (uint64_t)nEvents * nChannels * sizeof(Double_t));
+    header.fileSize = header.baselineMeanOffset + (uint64_t)nEvents * nChannels * sizeof(Double_t);
+    return header;
+}
+
+// Read-only mapping of a cache file
+struct WaveformCache {
+    int nChannels = 0;
+    int nSamples = 0;
+    Long64_t nEvents = 0;
+
+    const char *mapping = nullptr;
+    size_t mappingSize = 0;
+    const Short_t *adcVal = nullptr;
+    const Double_t *area = nullptr;
+    const Double_t *baselineMean = nullptr;
+
+    WaveformCache() {}
+    WaveformCache(const WaveformCache &) = delete;
+    WaveformCache &operator=(const WaveformCache &) = delete;
+    ~WaveformCache() { close(); }
+
+    // Map the cache of fileName; fails quietly if it is missing, has another format or shape, is older than the ROOT file,
+    // or its section offsets or size don't match the layout of its event count
+    bool open(const char *fileName, int channels, int samples) {
+        struct stat source;
+        if (stat(fileName, &source) != 0) return false;
+        std::string cacheFileName = waveformCacheFileName(fileName);
+        int fd = ::open(cacheFileName.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        WaveformCacheHeader header;
+        struct stat cacheStat;
+        bool ok = ::read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && fstat(fd, &cacheStat) == 0 &&
+                  memcmp(header.magic, "WCCH", 4) == 0 && header.version == waveformCacheVersion &&
+                  header.nChannels == (uint32_t)channels && header.nSamples == (uint32_t)samples &&
+                  header.sourceSize == (int64_t)source.st_size && header.sourceMTime == (int64_t)source.st_mtime &&
+                  header.fileSize == (uint64_t)cacheStat.st_size && header.nEvents >= 0;
+        if (ok) {
+            WaveformCacheHeader expected = makeWaveformCacheHeader(channels, samples, header.nEvents, source);
+            ok = header.samplesOffset == expected.samplesOffset && header.areaOffset == expected.areaOffset &&
+                 header.baselineMeanOffset == expected.baselineMeanOffset && header.fileSize == expected.fileSize;
+        }
+        if (ok) {
+            void *address = mmap(nullptr, header.fileSize, PROT_READ, MAP_SHARED, fd, 0);
+            ok = address != MAP_FAILED;
+            if (ok) {
+                mapping = (const char*)address;
+                mappingSize = header.fileSize;
+            }
+        }
+        ::close(fd); // The mapping stays valid
+        if (!ok) return false;
+
+        nChannels = channels;
+        nSamples = samples;
+        nEvents = header.nEvents;
+        adcVal = (const Short_t*)(mapping + header.samplesOffset);
+        area = (const Double_t*)(mapping + header.areaOffset);
+        baselineMean = (const Double_t*)(mapping + header.baselineMeanOffset);
+        return true;
+    }
+
+    // Elements between the samples of consecutive channels of an event
+    Long64_t channelStride() const {
+        return nEvents * nSamples;
+    }
+
+    // Samples of channel 0 of an event; channel c starts channelStride() samples further per channel
+    const Short_t *eventSamples(Long64_t EventID) const {
+        return adcVal + EventID * nSamples;
+    }
+
+    const Double_t *eventArea(Long64_t EventID) const {
+        return area + EventID * nChannels;
+    }
+
+    const Double_t *eventBaselineMean(Long64_t EventID) const {
+        return baselineMean + EventID * nChannels;
+    }
+
+    // Ask the kernel to read the pages of the events [first, last] ahead
+    void prefetch(Long64_t first, Long64_t last) const {
+        for (int channel = 0; channel < nChannels; channel++) {
+            adviseWillNeed(adcVal + channel * channelStride() + first * nSamples, (last - first + 1) * nSamples * sizeof(Short_t));
+        }
+        adviseWillNeed(eventArea(first), (last - first + 1) * nChannels * sizeof(Double_t));
+        adviseWillNeed(eventBaselineMean(first), (last - first + 1) * nChannels * sizeof(Double_t));
+    }
+
+    void close() {
+        if (mapping) munmap((void*)mapping, mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+        adcVal = nullptr;
+        area = nullptr;
+        baselineMean = nullptr;
+        nEvents = 0;
+    }
+
+private:
+    void adviseWillNeed(const void *start, size_t length) const {
+        uintptr_t page = (uintptr_t)start / waveformCacheAlignment * waveformCacheAlignment; // madvise wants a page-aligned start
+        madvise((void*)page, length + ((uintptr_t)start - page), MADV_WILLNEED);
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+// Export of a run to its columnar cache (<file>.wcache, format in WaveformCache.h). The tree is read in
+// parallel, one contiguous block of events per worker, and every worker writes its events straight into
+// the memory-mapped output file. The cache is written under a temporary name and renamed when complete,
+// so readers never map a partial cache. The whole file is allocated before it is mapped: if the disk is too full
+// for the cache the run is read from the tree as before, instead of faulting on a page of a sparse mapping.
+#ifndef WAVEFORMCACHEBUILDER_H
+#define WAVEFORMCACHEBUILDER_H
+
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <TStopwatch.h>
+#include "WaveformCache.h"
+#include "WaveformReader.h"
+#include "WorkerPool.h"
+
+inline bool buildWaveformCache(const char *fileName, const DetectorGeometry &geometry, int nWorkers) {
+    TStopwatch timer;
+    struct stat source;
+    if (stat(fileName, &source) != 0) {
+        std::cerr << "Error opening file: " << fileName << std::endl;
+        return false;
+    }
+    Long64_t n = 0;
+    {
+        WaveformReader reader;
+        if (!reader.open(fileName, geometry, false)) return false;
+        n = reader.nEntries;
+    }
+
+    std::string cacheFileName = waveformCacheFileName(fileName);
+    std::string partialFileName = cacheFileName + ".partial";
+    std::cout << "Building waveform cache " << cacheFileName << std::endl;
+
+    int nChannels = geometry.nChannels;
+    int nSamples = geometry.nSamples;
+    WaveformCacheHeader header = makeWaveformCacheHeader(nChannels, nSamples, n, source);
+    int fd = ::open(partialFileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0) {
+        int error = posix_fallocate(fd, 0, header.fileSize);
+        if (error != 0) {
+            std::cerr << "Warning: can't allocate " << header.fileSize / 1048576.0 << " MB for waveform cache " << partialFileName << ": "
+                      << strerror(error) << "; reading the tree without a cache" << std::endl;
+            ::close(fd);
+            unlink(partialFileName.c_str());
+            return true; // The run is still readable from the tree
+        }
+    }
+    void *address = MAP_FAILED;
+    if (fd >= 0) address = mmap(nullptr, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+        std::cerr << "Error writing waveform cache " << partialFileName << ": " << strerror(errno) << std::endl;
+        if (fd >= 0) ::close(fd);
+        unlink(partialFileName.c_str());
+        return false;
+    }
+    char *mapping = (char*)address;
+    memcpy(mapping, &header, sizeof(header));
+    Short_t *adcOut = (Short_t*)(mapping + header.samplesOffset);
+    Double_t *areaOut = (Double_t*)(mapping + header.areaOffset);
+    Double_t *baselineMeanOut = (Double_t*)(mapping + header.baselineMeanOffset);
+
+    if (nWorkers < 1) nWorkers = defaultWorkerCount();
+    if (nWorkers > n) nWorkers = n > 0 ? (int)n : 1;
+
+    std::atomic<bool> ok(true);
+    runWorkers(nWorkers, [&](int worker) {
+        Long64_t first = n * worker / nWorkers;
+        Long64_t last = n * (worker + 1) / nWorkers - 1;
+        if (first > last) return;
+        WaveformReader reader;
+        if (!reader.open(fileName, geometry, false)) {
+            ok = false;
+            return;
+        }
+        reader.setEntryRange(first, last);
+        for (Long64_t EventID = first; EventID <= last; EventID++) {
+            if (!reader.load(EventID)) {
+                ok = false;
+                return;
+            }
+            for (int channel = 0; channel < nChannels; channel++) {
+                memcpy(adcOut + ((Long64_t)channel * n + EventID) * nSamples, reader.samples(channel), nSamples * sizeof(Short_t));
+            }
+            memcpy(areaOut + EventID * nChannels, reader.area, nChannels * sizeof(Double_t));
+            memcpy(baselineMeanOut + EventID * nChannels, reader.baselineMean, nChannels * sizeof(Double_t));
+        }
+    });
+
+    munmap(address, header.fileSize);
+    ::close(fd);
+    if (!ok || rename(partialFileName.c_str(), cacheFileName.c_str()) != 0) {
+        if (ok) std::cerr << "Error writing waveform cache " << cacheFileName << ": " << strerror(errno) << std::endl;
+        unlink(partialFileName.c_str());
+        return false;
+    }
+
+    timer.Stop();
+    std::cout << "Cached " << n << " events (" << header.fileSize / 1048576.0 << " MB) in " << timer.RealTime() << " s" << std::endl;
+    return true;
+}
+
+#endif
@@ -0,0 +1,239 @@
+// Lightweight exports of the loaded event for the svg, json and raster outputs (PlotOutput.h). All are built from
+// the samples directly, without a ROOT canvas:
+//   SVG   one polyline per channel on a grid of pads, with the same title and area/baseline/peak lines as the
+//         ROOT plots, a few kB per chart
+//   JSON  the samples, area, baselineMean and features of every PMT and SiPM plus the combined chart layout,
+//         for drawing on the client side, and with calibrated plots the calibration of every channel
+//   raster a small thumbnail of the layout of pads, drawn into a reusable image (RasterImage.h) with the title,
+//         area and baseline mean of every channel; a few kB as PNG
+// Calibrated plots (Calibration.h) draw the baseline-subtracted signal, in photoelectrons where the gain is known.
+#ifndef WAVEFORMEXPORT_H
+#define WAVEFORMEXPORT_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include "DetectorGeometry.h"
+#include "WaveformReader.h"
+#include "WaveformFeatures.h"
+#include "Calibration.h"
+#include "RasterImage.h"
+
+// Pad size of the SVG charts in user units
+const double svgPadWidth = 240;
+const double svgPadHeight = 200;
+
+// Pad size of the raster thumbnails in pixels, and the height of the line below the pads
+const int rasterPadWidth = 120;
+const int rasterPadHeight = 90;
+const int rasterFooterHeight = 10;
+
+// Fixed-point numbers keep the documents small
+inline void appendNumber(std::string &out, double value, int decimals) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, value);
+    out += buffer;
+}
+
+inline void appendSVGText(std::string &out, double x, double y, double size, const char *anchor, const char *color, const std::string &text) {
+    out += "<text x=\"";
+    appendNumber(out, x, 1);
+    out += "\" y=\"";
+    appendNumber(out, y, 1);
+    out += "\" font-size=\"";
+    appendNumber(out, size, 1);
+    out += "\" text-anchor=\"";
+    out += anchor;
+    out += "\" fill=\"";
+    out += color;
+    out += "\">" + text + "</text>\n";
+}
+
+// One pad at (x, y) of size width x height: frame, waveform, channel title and the numbers of the channel
+inline void appendSVGPad(std::string &out, double x, double y, double width, double height, const DetectorGeometry &geometry,
+                         const WaveformReader &reader, const EventFeatures &features, int detectorChannel, const EventScale &scale) {
+    int adcIndex = geometry.adcChannel(detectorChannel);
+    const ChannelFeatures &f = features.channel[adcIndex];
+    ChannelScale channel = scale.channel(adcIndex);
+    double left = x + 0.06 * width, right = x + 0.96 * width;
+    double top = y + 0.06 * height, bottom = y + 0.94 * height;
+
+    out += "<rect x=\"";
+    appendNumber(out, left, 1);
+    out += "\" y=\"";
+    appendNumber(out, top, 1);
+    out += "\" width=\"";
+    appendNumber(out, right - left, 1);
+    out += "\" height=\"";
+    appendNumber(out, bottom - top, 1);
+    out += "\" fill=\"none\" stroke=\"#888\"/>\n";
+
+    // Samples outside [floor, ceiling] are clipped to the frame
+    out += "<polyline fill=\"none\" stroke=\"#000\" stroke-width=\"1.5\" points=\"";
+    const Short_t *samples = reader.samples(adcIndex);
+    double range = channel.ceiling > channel.floor ? channel.ceiling - channel.floor : 1;
+    for (int k = 0; k < geometry.nSamples; k++) {
+        double value = std::min(std::max(channel.apply(samples[k]), channel.floor), channel.ceiling);
+        appendNumber(out, left + sampleTime(k) / geometry.timeWindow() * (right - left), 1);
+        out += ",";
+        appendNumber(out, bottom - (value - channel.floor) / range * (bottom - top), 1);
+        out += " ";
+    }
+    out += "\"/>\n";
+
+    double textSize = 0.055 * height;
+    appendSVGText(out, x + width / 2, top + textSize, textSize * 1.3, "middle", "#000", geometry.channelName(detectorChannel));
+    char line[96];
+    snprintf(line, sizeof(line), "Area: %.2f", reader.area[adcIndex]);
+    appendSVGText(out, left + 4, top + 2.4 * textSize, textSize, "start", "#00f", line);
+    snprintf(line, sizeof(line), "BM: %.2f", reader.baselineMean[adcIndex]);
+    appendSVGText(out, left + 4, top + 3.4 * textSize, textSize, "start", "#f00", line);
+    if (channel.calibrated) {
+        snprintf(line, sizeof(line), "Peak: %.1f %s at %.0f ns", channel.apply(f.peak), channel.unit(), sampleTime(f.peakSample));
+    } else {
+        snprintf(line, sizeof(line), "Peak: %d at %.0f ns", f.peak, sampleTime(f.peakSample));
+    }
+    appendSVGText(out, left + 4, top + 4.4 * textSize, textSize, "start", "#080", line);
+}
+
+inline std::string svgHeader(double width, double height) {
+    std::string out = "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 ";
+    appendNumber(out, width, 0);
+    out += " ";
+    appendNumber(out, height, 0);
+    out += "\" font-family=\"sans-serif\">\n<rect width=\"100%\" height=\"100%\" fill=\"#fff\"/>\n";
+    return out;
+}
+
+// Chart of a layout of pads (combined_row or pmt_row grid), with the axis legend below
+inline std::string layoutSVG(const DetectorGeometry &geometry, const WaveformReader &reader, const EventFeatures &features,
+                             int rows, int cols, const std::vector<int> &layout, const EventScale &scale) {
+    double legendHeight = 30;
+    std::string out = svgHeader(cols * svgPadWidth, rows * svgPadHeight + legendHeight);
+    for (int pad = 0; pad < rows * cols; pad++) {
+        if (layout[pad] >= 0) {
+            appendSVGPad(out, (pad % cols) * svgPadWidth, (pad / cols) * svgPadHeight, svgPadWidth, svgPadHeight,
+                         geometry, reader, features, layout[pad], scale);
+        }
+    }
+    char legend[160];
+    if (scale.calibrated()) {
+        snprintf(legend, sizeof(legend), "X axis: Time (0-%.0f) ns, Y axis: signal above baseline (up to %.0f PE, %.0f ADC without gain)",
+                 geometry.timeWindow(), scale.maximum, scale.maximumADC);
+    } else {
+        snprintf(legend, sizeof(legend), "X axis: Time (0-%.0f) ns, Y axis: ADC values (%.0f-%.0f)", geometry.timeWindow(), defaultADCFloor, scale.maximum);
+    }
+    appendSVGText(out, 8, rows * svgPadHeight + 20, 14, "start", "#000", legend);
+    out += "</svg>\n";
+    return out;
+}
+
+// Chart of a single channel, as the individual plots
+inline std::string channelSVG(const DetectorGeometry &geometry, const WaveformReader &reader, const EventFeatures &features,
+                              int detectorChannel, const EventScale &scale) {
+    std::string out = svgHeader(800, 600);
+    appendSVGPad(out, 0, 0, 800, 600, geometry, reader, features, detectorChannel, scale);
+    out += "</svg>\n";
+    return out;
+}
+
+// One raster pad at (x, y): frame, waveform (clipped to the frame) and the title, area and baseline mean of the channel
+inline void drawRasterPad(RasterImage &image, int x, int y, const DetectorGeometry &geometry, const WaveformReader &reader,
+                          int detectorChannel, const EventScale &scale) {
+    int adcIndex = geometry.adcChannel(detectorChannel);
+    ChannelScale channel = scale.channel(adcIndex);
+    int left = x + 2, right = x + rasterPadWidth - 3;
+    int top = y + 2, bottom = y + rasterPadHeight - 3;
+    image.rectangle(left, top, right, bottom, RasterImage::kGray);
+
+    const Short_t *samples = reader.samples(adcIndex);
+    double range = channel.ceiling > channel.floor ? channel.ceiling - channel.floor : 1;
+    double xScale = (right - left - 2) / geometry.timeWindow(), yScale = (bottom - top - 2) / range;
+    int previousX = 0, previousY = 0;
+    for (int k = 0; k < geometry.nSamples; k++) {
+        double value = std::min(std::max(channel.apply(samples[k]), channel.floor), channel.ceiling);
+        int pointX = left + 1 + (int)(sampleTime(k) * xScale + 0.5);
+        int pointY = bottom - 1 - (int)((value - channel.floor) * yScale + 0.5);
+        if (k > 0) image.line(previousX, previousY, pointX, pointY, RasterImage::kBlack);
+        previousX = pointX;
+        previousY = pointY;
+    }
+
+    std::string title = geometry.channelName(detectorChannel);
+    image.text(x + (rasterPadWidth - RasterImage::textWidth(title)) / 2, top + 2, title, RasterImage::kBlack);
+    char line[48];
+    snprintf(line, sizeof(line), "Area: %.1f", reader.area[adcIndex]);
+    image.text(left + 3, top + 9, line, RasterImage::kBlue);
+    snprintf(line, sizeof(line), "BM: %.1f", reader.baselineMean[adcIndex]);
+    image.text(left + 3, top + 15, line, RasterImage::kRed);
+}
+
+// Thumbnail of a layout of pads (combined_row or pmt_row grid) with the event and the y range below, drawn into
+// image, which keeps its buffer between events
+inline void layoutRaster(RasterImage &image, const DetectorGeometry &geometry, const WaveformReader &reader,
+                         int rows, int cols, const std::vector<int> &layout, const EventScale &scale, Long64_t EventID) {
+    image.reset(cols * rasterPadWidth, rows * rasterPadHeight + rasterFooterHeight);
+    for (int pad = 0; pad < rows * cols; pad++) {
+        if (layout[pad] >= 0) {
+            drawRasterPad(image, (pad % cols) * rasterPadWidth, (pad / cols) * rasterPadHeight, geometry, reader, layout[pad], scale);
+        }
+    }
+    char legend[96];
+    if (scale.calibrated()) {
+        snprintf(legend, sizeof(legend), "Event %lld  Y: signal up to %.0f PE", EventID, scale.maximum);
+    } else {
+        snprintf(legend, sizeof(legend), "Event %lld  Y: ADC %.0f-%.0f", EventID, defaultADCFloor, scale.maximum);
+    }
+    image.text(3, rows * rasterPadHeight + 3, legend, RasterImage::kBlack);
+}
+
+// All channels of the event with the combined chart layout (pads hold indexes into channels, -1 for empty), and
+// the calibration of every channel when a table is given
+inline std::string eventJSON(const DetectorGeometry &geometry, const WaveformReader &reader, const EventFeatures &features, Long64_t EventID,
+                             const CalibrationTable *calibration = nullptr) {
+    std::string out = "{\"event\":" + std::to_string(EventID) + ",\"geometry\":\"" + geometry.name + "\",\"sample_ns\":16,\"samples\":" +
+                      std::to_string(geometry.nSamples) + ",\"layout\":{\"rows\":" + std::to_string(geometry.combinedRows) +
+                      ",\"cols\":" + std::to_string(geometry.combinedCols) + ",\"pads\":[";
+    for (size_t pad = 0; pad < geometry.combinedLayout.size(); pad++) {
+        if (pad > 0) out += ",";
+        out += std::to_string(geometry.combinedLayout[pad]);
+    }
+    out += "]},\"channels\":[";
+    for (int detectorChannel = 0; detectorChannel < geometry.nDetectorChannels(); detectorChannel++) {
+        int adcIndex = geometry.adcChannel(detectorChannel);
+        const ChannelFeatures &f = features.channel[adcIndex];
+        if (detectorChannel > 0) out += ",";
+        out += "\n{\"name\":\"" + geometry.channelName(detectorChannel) + "\",\"adc\":" + std::to_string(adcIndex) + ",\"area\":";
+        appendNumber(out, reader.area[adcIndex], 2);
+        out += ",\"baselineMean\":";
+        appendNumber(out, reader.baselineMean[adcIndex], 2);
+        out += ",\"peak\":" + std::to_string(f.peak) + ",\"peak_ns\":";
+        appendNumber(out, sampleTime(f.peakSample), 0);
+        out += ",\"rise_ns\":";
+        appendNumber(out, f.riseTime, 1);
+        if (calibration) {
+            const ChannelCalibration &c = calibration->channels[adcIndex];
+            out += ",\"calibration\":{\"baseline\":";
+            appendNumber(out, c.baseline, 2);
+            out += ",\"noise\":";
+            appendNumber(out, c.noise, 2);
+            out += ",\"gain\":";
+            appendNumber(out, c.gain, 2);
+            out += ",\"spe_amplitude\":";
+            appendNumber(out, c.speAmplitude, 2);
+            out += "}";
+        }
+        out += ",\"adcVal\":[";
+        const Short_t *samples = reader.samples(adcIndex);
+        for (int k = 0; k < geometry.nSamples; k++) {
+            if (k > 0) out += ",";
+            out += std::to_string(samples[k]);
+        }
+        out += "]}";
+    }
+    out += "]}\n";
+    return out;
+}
+
+#endif
@@ -0,0 +1,114 @@
+// Reusable ROOT objects for waveform plots. The graph and labels of a plot are created and drawn on
+// their pad once; for every new event only the point values, the y-axis range and the label texts are
+// updated, so rendering many events neither allocates ROOT objects nor grows memory.
+#ifndef WAVEFORMPLOT_H
+#define WAVEFORMPLOT_H
+
+#include <TGraph.h>
+#include <TLatex.h>
+#include <TAxis.h>
+#include <TPolyMarker.h>
+#include <sys/resource.h>
+#include <vector>
+#include "WaveformFeatures.h"
+#include "PulseFinder.h"
+#include "Profiler.h"
+#include "Calibration.h"
+
+// Graph with one point per sample at the sample times; the y values are set per event
+inline TGraph *makeWaveformGraph(int nSamples) {
+    TGraph *graph = new TGraph(nSamples);
+    profiler().count(Profiler::kObjectsAllocated);
+    for (int k = 0; k < nSamples; k++) {
+        graph->SetPoint(k, sampleTime(k), 0);
+    }
+    graph->SetLineWidth(3);     // Set line width to 3 for thicker lines
+    graph->SetLineColor(kBlack); // Set line color to black
+    return graph;
+}
+
+// Text label in NDC coordinates, drawn on the current pad; the text is set per event
+inline TLatex *makeLabel(double x, double y, double size, int align, Color_t color = kBlack) {
+    TLatex *label = new TLatex(x, y, "");
+    profiler().count(Profiler::kObjectsAllocated);
+    label->SetTextSize(size);
+    label->SetTextAlign(align);
+    label->SetNDC(true);
+    label->SetTextColor(color);
+    label->Draw();
+    return label;
+}
+
+// Graph and labels of one channel's plot
+struct WaveformPlot {
+    TGraph *graph = nullptr;
+    TLatex *title = nullptr;    // Only on the combined views
+    TLatex *infoArea = nullptr;
+    TLatex *infoBaseline = nullptr;
+    TLatex *infoPeak = nullptr;
+    TPolyMarker *pulseMarkers = nullptr;  // Peaks of the pulses found, only with the pulse overlay
+    TPolyMarker *pileUpMarkers = nullptr; // Peaks of piled-up pulses
+    TLatex *infoPulses = nullptr;
+    std::vector<double> pulseX, pulseY, pileUpX, pileUpY; // Marker positions, reused between events
+
+    // Copy the samples of a channel into the graph buffer, scaled (e.g. baseline-subtracted in photoelectrons),
+    // and set the y-axis range
+    void setSamples(const Short_t *samples, const ChannelScale &scale) {
+        double *y = graph->GetY();
+        if (scale.calibrated) {
+            for (int k = 0; k < graph->GetN(); k++) {
+                y[k] = scale.apply(samples[k]);
+            }
+            graph->GetYaxis()->SetTitle(scale.axisTitle());
+        } else {
+            for (int k = 0; k < graph->GetN(); k++) {
+                y[k] = samples[k];
+            }
+        }
+        graph->SetMinimum(scale.floor);
+        graph->SetMaximum(scale.ceiling); // Set y-axis maximum based on the highest peak of the event
+    }
+
+    // Draw the pulse overlay on the current pad, with its label at (x, y) in NDC coordinates
+    void addPulseOverlay(double x, double y, double size) {
+        pulseMarkers = new TPolyMarker();
+        pulseMarkers->SetMarkerStyle(23); // Full triangle pointing down at the peak
+        pulseMarkers->SetMarkerColor(kBlue);
+        pulseMarkers->SetMarkerSize(1.5);
+        pulseMarkers->Draw();
+        pileUpMarkers = new TPolyMarker();
+        pileUpMarkers->SetMarkerStyle(23);
+        pileUpMarkers->SetMarkerColor(kMagenta + 1);
+        pileUpMarkers->SetMarkerSize(1.5);
+        pileUpMarkers->Draw();
+        infoPulses = makeLabel(x, y, size, 13, kMagenta + 1);
+        profiler().count(Profiler::kObjectsAllocated, 2);
+    }
+
+    // Mark the pulses found on an ADC channel of the loaded event at their peaks, scaled as the samples
+    void setPulses(const EventFeatures &features, int adcIndex, const ChannelScale &scale) {
+        pulseX.clear();
+        pulseY.clear();
+        pileUpX.clear();
+        pileUpY.clear();
+        for (int i = features.firstPulse[adcIndex]; i < features.firstPulse[adcIndex + 1]; i++) {
+            const Pulse &pulse = features.pulses[i];
+            bool pileUp = pulse.flags & pulsePileUp;
+            (pileUp ? pileUpX : pulseX).push_back(sampleTime(pulse.peakSample));
+            (pileUp ? pileUpY : pulseY).push_back(scale.apply(features.channel[adcIndex].baseline + pulse.amplitude));
+        }
+        pulseMarkers->SetPolyMarker((int)pulseX.size(), pulseX.data(), pulseY.data());
+        pileUpMarkers->SetPolyMarker((int)pileUpX.size(), pileUpX.data(), pileUpY.data());
+        int nPulses = (int)(pulseX.size() + pileUpX.size());
+        infoPulses->SetTitle(pileUpX.empty() ? Form("Pulses: %d", nPulses) : Form("Pulses: %d, %d piled up", nPulses, (int)pileUpX.size()));
+    }
+};
+
+// Peak resident set size of the process in MB
+inline double peakRSSMB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // ru_maxrss is in kB on Linux
+}
+
+#endif
@@ -0,0 +1,258 @@
+// Reader for the waveform TTree written by the DAQ ("tree" with adcVal, area and baselineMean).
+// The file is opened and the branch addresses are bound once, so any number of events
+// can be loaded afterwards without paying the open cost again.
+// Only the three bound branches are read: every other branch of the tree is disabled and the
+// bound ones are served from a TTreeCache, optionally with asynchronous basket prefetching.
+// The buffers are sized by the detector geometry, which must match the shape of the branches.
+// When an up-to-date columnar cache of the file exists (WaveformCache.h), events are served from its
+// memory mapping instead: loading an event only moves the adc/area/baselineMean pointers.
+// Opened on a run of several files (RunFiles.h), EventIDs are run-global and the reader switches to the
+// file holding the requested event, so consecutive events of one file keep their cache and prefetching.
+#ifndef WAVEFORMREADER_H
+#define WAVEFORMREADER_H
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <TFile.h>
+#include <TTree.h>
+#include <TLeaf.h>
+#include <TEnv.h>
+#include "DetectorGeometry.h"
+#include "RunFiles.h"
+#include "WaveformCache.h"
+#include "WaveformFeatures.h"
+#include "PulseFinder.h"
+
+struct WaveformReader {
+    TFile *file = nullptr;
+    TTree *tree = nullptr;
+    Long64_t nEntries = 0;
+
+    // The loaded event: channel c has nSamples ADC values at adc + c * channelStride, area[c] and baselineMean[c]
+    int nChannels = 0;
+    int nSamples = 0;
+    const Short_t *adc = nullptr;
+    Long64_t channelStride = 0;
+    const Double_t *area = nullptr;
+    const Double_t *baselineMean = nullptr;
+
+    // Buffers the branches are bound to
+    std::vector<Short_t> adcBuffer;          // ADC values [channel][time bin]
+    std::vector<Double_t> areaBuffer;        // Area for each channel
+    std::vector<Double_t> baselineMeanBuffer; // Baseline mean for each channel
+
+    // Columnar cache used instead of the tree when it is mapped
+    WaveformCache cache;
+
+    // Run the reader was opened on, if any, and the file of it that is open
+    const RunFiles *run = nullptr;
+    const DetectorGeometry *runGeometry = nullptr;
+    bool runUseCache = true;
+    int runFile = -1;
+    Long64_t rangeFirst = 0, rangeLast = -1; // Run-global entry range, applied to each file as it is opened
+
+    // I/O statistics of this reader
+    Long64_t eventsLoaded = 0;
+    Long64_t bytesDecompressed = 0; // Uncompressed bytes returned by GetEntry
+    Long64_t closedBytesRead = 0;   // Bytes read from files of the run that were closed again
+
+    WaveformReader() {}
+    WaveformReader(const WaveformReader &) = delete; // Branch addresses point into this object
+    WaveformReader &operator=(const WaveformReader &) = delete;
+    ~WaveformReader() { close(); }
+
+    // Let ROOT read the baskets of upcoming entries asynchronously in files opened from now on.
+    // This changes a global setting, so call it before any worker thread opens a file.
+    static void enableAsyncPrefetching() {
+        gEnv->SetValue("TFile.AsyncPrefetching", 1);
+    }
+
+    // Samples of an ADC channel of the loaded event
+    const Short_t *samples(int adcIndex) const {
+        return adc + adcIndex * channelStride;
+    }
+
+    // Features of all channels of the loaded event
+    void extractFeatures(EventFeatures &features) const {
+        extractEventFeatures(adc, nChannels, nSamples, channelStride, features);
+    }
+
+    // Pulses of all channels of the loaded event into features.pulses
+    void findPulses(EventFeatures &features, const PulseFinderConfig &config) const {
+        findEventPulses(adc, nChannels, nSamples, channelStride, features, config);
+    }
+
+    bool cached() const {
+        return cache.mapping != nullptr;
+    }
+
+    // Open a run; EventIDs passed to load() are run-global from now on
+    bool open(const RunFiles &files, const DetectorGeometry &geometry, bool useCache = true) {
+        close();
+        run = &files;
+        runGeometry = &geometry;
+        runUseCache = useCache;
+        return openRunFile(0);
+    }
+
+    // Map the cache of the file if it is up to date (unless useCache is false), otherwise
+    // open the ROOT file, access the TTree and bind the branch addresses
+    bool open(const char *fileName, const DetectorGeometry &geometry, bool useCache = true) {
+        nChannels = geometry.nChannels;
+        nSamples = geometry.nSamples;
+        if (useCache && cache.open(fileName, nChannels, nSamples)) {
+            nEntries = cache.nEvents;
+            channelStride = cache.channelStride();
+            return true;
+        }
+
+        file = TFile::Open(fileName);
+        if (!file || file->IsZombie()) {
+            std::cerr << "Error opening file: " << fileName << std::endl;
+            file = nullptr;
+            return false;
+        }
+
+        tree = (TTree*)file->Get("tree");
+        if (!tree) {
+            std::cerr << "Error accessing TTree 'tree'!" << std::endl;
+            closeFile();
+            return false;
+        }
+
+        // The branches must hold exactly the values the geometry describes
+        if (!checkLeafLength("adcVal", nChannels * nSamples, geometry) || !checkLeafLength("area", nChannels, geometry) ||
+            !checkLeafLength("baselineMean", nChannels, geometry)) {
+            closeFile();
+            return false;
+        }
+        adcBuffer.assign(nChannels * nSamples, 0);
+        areaBuffer.assign(nChannels, 0);
+        baselineMeanBuffer.assign(nChannels, 0);
+        adc = adcBuffer.data();
+        channelStride = nSamples;
+        area = areaBuffer.data();
+        baselineMean = baselineMeanBuffer.data();
+
+        // Disable all branches we don't use so GetEntry only decompresses the bound ones
+        tree->SetBranchStatus("*", false);
+        tree->SetBranchStatus("adcVal", true);
+        tree->SetBranchStatus("area", true);
+        tree->SetBranchStatus("baselineMean", true);
+
+        tree->SetBranchAddress("adcVal", adcBuffer.data());
+        tree->SetBranchAddress("area", areaBuffer.data());
+        tree->SetBranchAddress("baselineMean", baselineMeanBuffer.data());
+
+        // Read the bound branches through a TTreeCache; learning only sees the enabled branches
+        tree->SetCacheSize(32 * 1024 * 1024);
+        tree->SetCacheLearnEntries(10);
+        tree->AddBranchToCache("adcVal", true);
+        tree->AddBranchToCache("area", true);
+        tree->AddBranchToCache("baselineMean", true);
+
+        nEntries = tree->GetEntries();
+        return true;
+    }
+
+    // Load the specified event into the buffers, or point at it in the cache
+    bool load(Long64_t EventID) {
+        if (EventID < 0 || EventID >= nEntries) {
+            std::cerr << "Error: EventID " << EventID << " is out of range (0-" << nEntries-1 << ")" << std::endl;
+            return false;
+        }
+        Long64_t entry = EventID;
+        if (run) {
+            int fileIndex = run->fileOf(EventID);
+            if (fileIndex != runFile && !openRunFile(fileIndex)) return false;
+            entry = EventID - run->firstEntry[fileIndex];
+        }
+        if (cached()) {
+            adc = cache.eventSamples(entry);
+            area = cache.eventArea(entry);
+            baselineMean = cache.eventBaselineMean(entry);
+            eventsLoaded++;
+            return true;
+        }
+        int nBytes = tree->GetEntry(entry);
+        if (nBytes <= 0) return false;
+        eventsLoaded++;
+        bytesDecompressed += nBytes;
+        return true;
+    }
+
+    // Restrict the cache to the entries [first, last] that are going to be loaded
+    void setEntryRange(Long64_t first, Long64_t last) {
+        rangeFirst = first;
+        rangeLast = last;
+        if (run) {
+            // Only the part of the range in the open file; the rest is applied when its files are opened
+            first = std::max(first, run->firstEntry[runFile]) - run->firstEntry[runFile];
+            last = std::min(last, run->firstEntry[runFile + 1] - 1) - run->firstEntry[runFile];
+            if (first > last) return;
+        }
+        if (cached()) cache.prefetch(first, last);
+        else tree->SetCacheEntryRange(first, last + 1);
+    }
+
+    // Pick up the entries a writer has flushed to the file since it was opened (not for a mapped cache,
+    // which doesn't grow with the file); the branch addresses stay bound. Returns the new number of entries.
+    Long64_t refresh() {
+        if (!tree) return nEntries;
+        tree->Refresh();
+        nEntries = tree->GetEntries();
+        return nEntries;
+    }
+
+    // Compressed bytes read from the ROOT file so far, including cache and prefetch reads (0 when mapped)
+    Long64_t bytesRead() const {
+        return closedBytesRead + (file ? file->GetBytesRead() : 0);
+    }
+
+    bool checkLeafLength(const char *branchName, int expected, const DetectorGeometry &geometry) const {
+        TLeaf *leaf = tree->GetLeaf(branchName);
+        if (!leaf) {
+            std::cerr << "Error accessing branch '" << branchName << "'!" << std::endl;
+            return false;
+        }
+        if (leaf->GetLen() != expected) {
+            std::cerr << "Error: branch '" << branchName << "' holds " << leaf->GetLen() << " values per event, detector geometry '"
+                      << geometry.name << "' expects " << expected << " (" << geometry.nChannels << " channels x "
+                      << geometry.nSamples << " samples)" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        closeFile();
+        run = nullptr;
+        runFile = -1;
+        nEntries = 0;
+    }
+
+private:
+    void closeFile() {
+        if (file) {
+            closedBytesRead += file->GetBytesRead();
+            file->Close();
+            delete file;
+        }
+        file = nullptr;
+        tree = nullptr;
+        cache.close();
+    }
+
+    // Switch to a file of the run; the entry range and the run-global entry count carry over
+    bool openRunFile(int fileIndex) {
+        closeFile();
+        runFile = fileIndex;
+        if (!open(run->fileNames[fileIndex].c_str(), *runGeometry, runUseCache)) return false;
+        nEntries = run->nEntries();
+        if (rangeFirst <= rangeLast) setEntryRange(rangeFirst, rangeLast);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,150 @@
+// Streaming summary of many events: per channel a time-vs-ADC persistence histogram and the
+// mean and RMS waveform. Memory is fixed (independent of the number of events): every worker
+// accumulates its own summary over contiguous blocks of the events of one file, and the summaries
+// of the workers are merged at the end. All sums are of integer samples, exact in double precision,
+// so the result does not depend on thread scheduling.
+#ifndef WAVEFORMSUMMARY_H
+#define WAVEFORMSUMMARY_H
+
+#include <cmath>
+#include <cstdint>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <utility>
+#include "WaveformReader.h"
+#include "WorkerPool.h"
+
+// ADC binning of the persistence histograms; values outside are counted in the first/last bin
+const int summaryADCBins = 512;
+const double summaryADCMin = 0;
+const double summaryADCMax = 4096;
+
+struct WaveformSummary {
+    int nChannels;
+    int nSamples;
+    Long64_t nEvents = 0;
+    std::vector<uint32_t> persistence; // Counts [channel][sample][adcBin]
+    std::vector<double> sum;           // Sum of the samples [channel][sample]
+    std::vector<double> sumSq;         // Sum of the squared samples [channel][sample]
+
+    WaveformSummary(int nChannels, int nSamples)
+        : nChannels(nChannels), nSamples(nSamples),
+          persistence(nChannels * nSamples * summaryADCBins, 0),
+          sum(nChannels * nSamples, 0),
+          sumSq(nChannels * nSamples, 0) {}
+
+    static int adcBin(Short_t value) {
+        int bin = (int)((value - summaryADCMin) * summaryADCBins / (summaryADCMax - summaryADCMin));
+        return bin < 0 ? 0 : (bin >= summaryADCBins ? summaryADCBins - 1 : bin);
+    }
+
+    // Add one event; channel c has nSamples samples at adc + c * channelStride
+    void fill(const Short_t *adc, Long64_t channelStride) {
+        for (int channel = 0; channel < nChannels; channel++) {
+            const Short_t *samples = adc + channel * channelStride;
+            for (int k = 0; k < nSamples; k++) {
+                int i = channel * nSamples + k;
+                double value = samples[k];
+                persistence[i * summaryADCBins + adcBin(samples[k])]++;
+                sum[i] += value;
+                sumSq[i] += value * value;
+            }
+        }
+        nEvents++;
+    }
+
+    void merge(const WaveformSummary &other) {
+        for (size_t i = 0; i < persistence.size(); i++) persistence[i] += other.persistence[i];
+        for (size_t i = 0; i < sum.size(); i++) {
+            sum[i] += other.sum[i];
+            sumSq[i] += other.sumSq[i];
+        }
+        nEvents += other.nEvents;
+    }
+
+    uint32_t count(int channel, int k, int bin) const {
+        return persistence[(channel * nSamples + k) * summaryADCBins + bin];
+    }
+
+    double mean(int channel, int k) const {
+        return nEvents > 0 ? sum[channel * nSamples + k] / nEvents : 0;
+    }
+
+    double rms(int channel, int k) const {
+        if (nEvents == 0) return 0;
+        double m = mean(channel, k);
+        double variance = sumSq[channel * nSamples + k] / nEvents - m * m;
+        return variance > 0 ? sqrt(variance) : 0;
+    }
+
+    // Upper edge of the highest filled ADC bin over all channels
+    double maxFilledADC() const {
+        int highest = 0;
+        for (size_t i = 0; i < persistence.size(); i++) {
+            int bin = i % summaryADCBins;
+            if (persistence[i] && bin > highest) highest = bin;
+        }
+        return summaryADCMin + (highest + 1) * (summaryADCMax - summaryADCMin) / summaryADCBins;
+    }
+};
+
+// Accumulate the summary of the given events in one pass, with one private summary per worker. The events are
+// grouped by file and every file is split into enough contiguous blocks to keep all workers busy (one task per
+// file when a run has at least as many files as workers). The worker summaries are merged once all tasks are done,
+// so no more than one partial summary per worker is ever in memory.
+inline bool accumulateSummary(const RunFiles &run, const DetectorGeometry &geometry, const std::vector<Long64_t> &events,
+                              int nWorkers, WaveformSummary &summary) {
+    if (nWorkers < 1) nWorkers = defaultWorkerCount();
+
+    std::vector<Long64_t> byFile(events);
+    std::stable_sort(byFile.begin(), byFile.end(), [&run](Long64_t a, Long64_t b) { return run.fileOf(a) < run.fileOf(b); });
+    int blocksPerFile = std::max(1, (nWorkers + run.nFiles() - 1) / run.nFiles());
+    std::vector<std::pair<size_t, size_t>> tasks; // [first, last) in byFile
+    size_t fileStart = 0;
+    while (fileStart < byFile.size()) {
+        int file = run.fileOf(byFile[fileStart]);
+        size_t fileEnd = fileStart;
+        while (fileEnd < byFile.size() && run.fileOf(byFile[fileEnd]) == file) fileEnd++;
+        for (int block = 0; block < blocksPerFile; block++) {
+            size_t first = fileStart + (fileEnd - fileStart) * block / blocksPerFile;
+            size_t last = fileStart + (fileEnd - fileStart) * (block + 1) / blocksPerFile;
+            if (first < last) tasks.push_back(std::make_pair(first, last));
+        }
+        fileStart = fileEnd;
+    }
+    if ((size_t)nWorkers > tasks.size()) nWorkers = tasks.empty() ? 1 : (int)tasks.size();
+
+    std::vector<std::unique_ptr<WaveformSummary>> partial(nWorkers);
+    std::atomic<size_t> nextTask(0);
+    std::atomic<bool> ok(true);
+    runWorkers(nWorkers, [&](int worker) {
+        WaveformReader reader;
+        if (!reader.open(run, geometry)) {
+            ok = false;
+            return;
+        }
+        partial[worker].reset(new WaveformSummary(summary.nChannels, summary.nSamples));
+        for (size_t task = nextTask++; task < tasks.size(); task = nextTask++) {
+            auto range = std::minmax_element(byFile.begin() + tasks[task].first, byFile.begin() + tasks[task].second);
+            reader.setEntryRange(*range.first, *range.second);
+            for (size_t i = tasks[task].first; i < tasks[task].second; i++) {
+                if (!reader.load(byFile[i])) {
+                    ok = false;
+                    return;
+                }
+                partial[worker]->fill(reader.adc, reader.channelStride);
+            }
+        }
+    });
+    if (!ok) return false;
+
+    for (std::unique_ptr<WaveformSummary> &workerSummary : partial) {
+        summary.merge(*workerSummary);
+        workerSummary.reset();
+    }
+    return true;
+}
+
+#endif
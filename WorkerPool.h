@@ -0,0 +1,53 @@
+// Minimal worker pool used to spread independent work (events, plots, files) over all cores.
+// Every worker gets its own index so it can own private ROOT objects (TFile, TTree, TCanvas).
+// ROOT::EnableThreadSafety covers I/O and the type system but not graphics: painting a pad goes through globals
+// (gVirtualPS, which TImage::FromPad swaps for its own dump, gPad, gStyle, the TTF font cache), so every thread
+// holds graphicsMutex() while it builds, draws, paints, encodes or deletes canvases and images.
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <TROOT.h>
+
+// Number of workers used when none is requested: one per hardware thread
+inline int defaultWorkerCount() {
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? (int)n : 1;
+}
+
+// Serializes console output of concurrent workers
+inline std::mutex &consoleMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Serializes ROOT graphics across the render workers and encoder threads
+inline std::mutex &graphicsMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Run body(workerIndex) on nWorkers threads and wait for all of them.
+// With a single worker the body runs in the calling thread, so the serial path is the same code.
+inline void runWorkers(int nWorkers, const std::function<void(int)> &body) {
+    if (nWorkers <= 1) {
+        body(0);
+        return;
+    }
+
+    ROOT::EnableThreadSafety(); // Required before ROOT objects are created from several threads
+
+    std::vector<std::thread> workers;
+    workers.reserve(nWorkers);
+    for (int worker = 0; worker < nWorkers; worker++) {
+        workers.emplace_back(body, worker);
+    }
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+#endif
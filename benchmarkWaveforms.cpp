@@ -0,0 +1,418 @@
+// Benchmark of the plotting pipeline on a synthetic waveform file (see SyntheticWaveforms.h), so the tools can be
+// performance-tested without detector data. The stages of lowlight() are timed separately on one thread:
+// file open, GetEntry, feature scan, pulse finding, canvas build, canvas update and PNG encode, plus the parallel
+// calibration pass over the file and how well it recovers the synthetic baseline and noise. The results are
+// written as JSON (per stage: count, total, mean and percentiles of the per-call latency) so runs can be compared
+// for regressions.
+// With --outputs the rendered events also go through each requested output backend (PlotOutput.h) to compare
+// throughput and bytes per event; --pack writes the per-plot formats into one archive instead of one file per plot.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <TCanvas.h>
+#include <TAxis.h>
+#include <TROOT.h>
+#include <TError.h>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "DetectorGeometry.h"
+#include "WaveformReader.h"
+#include "WaveformCacheBuilder.h"
+#include "WaveformFeatures.h"
+#include "WaveformPlot.h"
+#include "PlotOutput.h"
+#include "WaveformExport.h"
+#include "SyntheticWaveforms.h"
+#include "Profiler.h"
+#include "Calibration.h"
+
+using namespace std;
+
+struct BenchmarkOptions {
+    SyntheticConfig synthetic;
+    const char *geometry = defaultGeometryName;
+    const char *compression = nullptr;
+    string fileName;               // Synthetic file, or the file given with --input
+    bool generate = true;
+    bool keep = false;             // Keep the synthetic file
+    bool cache = false;            // Read through the memory-mapped waveform cache instead of the tree
+    int openRepeats = 10;
+    int buildRepeats = 3;
+    Long64_t pngEvents = 100;      // Events rendered to PNG (the slowest stage)
+    const char *jsonFileName = nullptr;
+    vector<string> outputs;        // Output backends compared on the rendered events
+    bool pack = false;             // Pack the per-plot outputs into one tar archive (OutputLayout.h)
+};
+
+// Result of rendering the same events through one output backend
+struct OutputResult {
+    string format;
+    double seconds = 0;        // Render and encode, until the last file is written
+    double encodeSeconds = 0;  // Encoding alone, on the background thread
+    Long64_t files = 0;
+    Long64_t bytes = 0;
+};
+
+void printBenchmarkUsage(const char *program) {
+    cerr << "Usage: " << program << " [options]" << endl
+         << "  --events <n>             synthetic events (default: 10000)" << endl
+         << "  --pulse <exp|gauss|square> pulse shape (default: exp)" << endl
+         << "  --amplitude <adc>        mean pulse height (default: 1500)" << endl
+         << "  --width <ns>             pulse decay time, sigma or length (default: 48)" << endl
+         << "  --occupancy <fraction>   fraction of channels with a pulse (default: 0.5)" << endl
+         << "  --noise <adc>            Gaussian noise sigma (default: 3)" << endl
+         << "  --compression <algo[:level]> none, zlib, lzma, lz4 or zstd (default: ROOT default)" << endl
+         << "  --seed <n>               random seed" << endl
+         << "  --geometry <name|file>   detector geometry (default: " << defaultGeometryName << ")" << endl
+         << "  --file <path>            where to write the synthetic file (default: /tmp/waveforms_benchmark_<pid>.root)" << endl
+         << "  --keep                   keep the synthetic file (and its cache)" << endl
+         << "  --cache                  build the <file>.wcache columnar cache and read through it" << endl
+         << "  --input <root_file>      benchmark an existing file instead of generating one" << endl
+         << "  --png-events <n>         events rendered to PNG (default: 100)" << endl
+         << "  --outputs <list|all>     compare output backends on the rendered events, e.g. png,thumb,svg (" << outputFormatNames << ")" << endl
+         << "  --pack                   pack the png, thumb, raster, svg and json outputs into one tar archive each" << endl
+         << "  --json <path>            write the results to a file instead of stdout" << endl;
+}
+
+bool parseBenchmarkOptions(int argc, char *argv[], BenchmarkOptions &options) {
+    options.fileName = Form("/tmp/waveforms_benchmark_%d.root", (int)getpid());
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--events" && hasValue) options.synthetic.nEvents = atoll(argv[++i]);
+        else if (arg == "--pulse" && hasValue) options.synthetic.pulse = argv[++i];
+        else if (arg == "--amplitude" && hasValue) options.synthetic.amplitude = atof(argv[++i]);
+        else if (arg == "--width" && hasValue) options.synthetic.width = atof(argv[++i]);
+        else if (arg == "--occupancy" && hasValue) options.synthetic.occupancy = atof(argv[++i]);
+        else if (arg == "--noise" && hasValue) options.synthetic.noise = atof(argv[++i]);
+        else if (arg == "--compression" && hasValue) options.compression = argv[++i];
+        else if (arg == "--seed" && hasValue) options.synthetic.seed = (unsigned)atol(argv[++i]);
+        else if (arg == "--geometry" && hasValue) options.geometry = argv[++i];
+        else if (arg == "--file" && hasValue) options.fileName = argv[++i];
+        else if (arg == "--keep") options.keep = true;
+        else if (arg == "--cache") options.cache = true;
+        else if (arg == "--input" && hasValue) {
+            options.fileName = argv[++i];
+            options.generate = false;
+        }
+        else if (arg == "--png-events" && hasValue) options.pngEvents = atoll(argv[++i]);
+        else if (arg == "--outputs" && hasValue) {
+            string list = string(argv[++i]) == "all" ? "png,thumb,raster,svg,json,pdf,root" : argv[i];
+            stringstream formats(list);
+            string format;
+            while (getline(formats, format, ',')) {
+                if (!isOutputFormat(format)) {
+                    cerr << "Error: unknown output format '" << format << "' (" << outputFormatNames << ")" << endl;
+                    return false;
+                }
+                options.outputs.push_back(format);
+            }
+        }
+        else if (arg == "--pack") options.pack = true;
+        else if (arg == "--json" && hasValue) options.jsonFileName = argv[++i];
+        else {
+            printBenchmarkUsage(argv[0]);
+            return false;
+        }
+    }
+    if (options.compression && !parseCompression(options.compression, options.synthetic.compression)) return false;
+    return true;
+}
+
+// The PMT-only chart of onlyPMTsWaveform, built from the same pooled plot objects
+struct BenchmarkCanvas {
+    TCanvas *canvas = nullptr;
+    vector<WaveformPlot> plots;
+};
+
+void buildBenchmarkCanvas(BenchmarkCanvas &chart, const DetectorGeometry &geometry, int repeat) {
+    chart.canvas = new TCanvas(Form("BenchmarkCanvas%d", repeat), "Combined PMT Waveforms", 3600, 3000);
+    chart.canvas->Divide(geometry.pmtCols, geometry.pmtRows, 0.007, 0.009);
+    chart.plots.assign(geometry.nPMTs(), WaveformPlot());
+    for (int pad = 0; pad < geometry.pmtRows * geometry.pmtCols; pad++) {
+        chart.canvas->cd(pad + 1);
+        int pmtIndex = geometry.pmtLayout[pad];
+        if (pmtIndex < 0) continue;
+        WaveformPlot &plot = chart.plots[pmtIndex];
+        plot.graph = makeWaveformGraph(geometry.nSamples);
+        plot.graph->SetTitle("");
+        plot.graph->GetXaxis()->SetTitle("Time (ns)");
+        plot.graph->GetYaxis()->SetTitle("ADC Value (mV)");
+        plot.graph->GetXaxis()->SetRangeUser(0, geometry.timeWindow());
+        plot.graph->Draw("AL");
+        plot.title = makeLabel(0.5, 0.94, 0.12, 22);
+        plot.title->SetTitle(Form("PMT %d", pmtIndex + 1));
+        plot.infoArea = makeLabel(0.2, 0.85, 0.04, 13, kBlue);
+        plot.infoBaseline = makeLabel(0.2, 0.80, 0.04, 13, kRed);
+        plot.infoPeak = makeLabel(0.2, 0.75, 0.04, 13, kGreen + 2);
+    }
+}
+
+void deleteBenchmarkCanvas(BenchmarkCanvas &chart) {
+    delete chart.canvas;
+    for (WaveformPlot &plot : chart.plots) {
+        delete plot.graph;
+        delete plot.title;
+        delete plot.infoArea;
+        delete plot.infoBaseline;
+        delete plot.infoPeak;
+    }
+    chart.plots.clear();
+}
+
+void updateBenchmarkCanvas(BenchmarkCanvas &chart, const DetectorGeometry &geometry, const WaveformReader &reader, const EventFeatures &features) {
+    EventScale scale = eventScale(features, nullptr);
+    for (int pad = 0; pad < geometry.pmtRows * geometry.pmtCols; pad++) {
+        int pmtIndex = geometry.pmtLayout[pad];
+        if (pmtIndex < 0) continue;
+        int adcIndex = geometry.adcChannel(pmtIndex);
+        WaveformPlot &plot = chart.plots[pmtIndex];
+        const ChannelFeatures &f = features.channel[adcIndex];
+        plot.setSamples(reader.samples(adcIndex), scale.channel(adcIndex));
+        plot.infoArea->SetTitle(Form("Area: %.2f", reader.area[adcIndex]));
+        plot.infoBaseline->SetTitle(Form("Baseline Mean: %.2f", reader.baselineMean[adcIndex]));
+        plot.infoPeak->SetTitle(Form("Peak: %d at %.0f ns, rise %.1f ns", f.peak, sampleTime(f.peakSample), f.riseTime));
+        chart.canvas->GetPad(pad + 1)->Modified();
+    }
+}
+
+// JSON string literal; the values written here never contain characters that need more than quote/backslash escapes
+string jsonString(const string &text) {
+    string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+int main(int argc, char *argv[]) {
+    BenchmarkOptions options;
+    if (!parseBenchmarkOptions(argc, argv, options)) return 1;
+
+    DetectorGeometry geometry;
+    if (!loadDetectorGeometry(options.geometry, geometry)) return 1;
+    if (geometry.pmtLayout.empty()) {
+        cerr << "Error: detector geometry '" << geometry.name << "' has no pmt_row layout" << endl;
+        return 1;
+    }
+
+    gROOT->SetBatch(true);
+    gErrorIgnoreLevel = kWarning; // Don't log every PNG
+
+    const char *fileName = options.fileName.c_str();
+    double generateSeconds = 0;
+    if (options.generate) {
+        cerr << "Generating " << options.synthetic.nEvents << " synthetic events in " << fileName << endl;
+        auto start = chrono::steady_clock::now();
+        if (!generateSyntheticFile(fileName, geometry, options.synthetic)) return 1;
+        generateSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    double cacheSeconds = 0;
+    if (options.cache) {
+        auto start = chrono::steady_clock::now();
+        if (!buildWaveformCache(fileName, geometry, 0)) return 1;
+        cacheSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+    struct stat fileStat;
+    Long64_t fileBytes = stat(fileName, &fileStat) == 0 ? (Long64_t)fileStat.st_size : 0;
+
+    // Open: file, tree, branch binding and cache setup
+    StageTimes openTimes;
+    for (int i = 0; i < options.openRepeats; i++) {
+        WaveformReader reader;
+        auto start = chrono::steady_clock::now();
+        if (!reader.open(fileName, geometry, options.cache)) return 1;
+        openTimes.add(start);
+    }
+
+    // Canvas build: canvas, pads, graphs and labels of one worker
+    StageTimes buildTimes;
+    for (int i = 0; i < options.buildRepeats; i++) {
+        BenchmarkCanvas chart;
+        auto start = chrono::steady_clock::now();
+        buildBenchmarkCanvas(chart, geometry, i);
+        buildTimes.add(start);
+        deleteBenchmarkCanvas(chart);
+    }
+
+    // Per event: GetEntry, feature scan, canvas update and, for the first events, PNG encode
+    WaveformReader reader;
+    if (!reader.open(fileName, geometry, options.cache)) return 1;
+    reader.setEntryRange(0, reader.nEntries - 1);
+    BenchmarkCanvas chart;
+    buildBenchmarkCanvas(chart, geometry, options.buildRepeats);
+    string pngFileName = Form("/tmp/waveforms_benchmark_%d.png", (int)getpid());
+
+    StageTimes entryTimes, featureTimes, pulseTimes, updateTimes, pngTimes;
+    EventFeatures features;
+    PulseFinderConfig pulseFinder;
+    Long64_t nPulses = 0;
+    auto scanStart = chrono::steady_clock::now();
+    for (Long64_t EventID = 0; EventID < reader.nEntries; EventID++) {
+        auto start = chrono::steady_clock::now();
+        if (!reader.load(EventID)) return 1;
+        entryTimes.add(start);
+
+        start = chrono::steady_clock::now();
+        reader.extractFeatures(features);
+        featureTimes.add(start);
+
+        start = chrono::steady_clock::now();
+        reader.findPulses(features, pulseFinder);
+        pulseTimes.add(start);
+        nPulses += features.pulses.size();
+    }
+    double scanSeconds = chrono::duration<double>(chrono::steady_clock::now() - scanStart).count();
+
+    // Calibration: baseline, noise and gain of every channel in one parallel pass over the file
+    CalibrationTable calibrationTable;
+    auto calibrationStart = chrono::steady_clock::now();
+    if (!calibrationTable.build(fileName, geometry, pulseFinder, 0)) return 1;
+    double calibrationSeconds = chrono::duration<double>(chrono::steady_clock::now() - calibrationStart).count();
+    double meanBaseline = 0, meanNoise = 0;
+    int nGains = 0;
+    for (const ChannelCalibration &c : calibrationTable.channels) {
+        meanBaseline += c.baseline / calibrationTable.channels.size();
+        meanNoise += c.noise / calibrationTable.channels.size();
+        nGains += c.gain > 0;
+    }
+
+    Long64_t nRendered = min(options.pngEvents, reader.nEntries);
+    for (Long64_t EventID = 0; EventID < nRendered; EventID++) {
+        if (!reader.load(EventID)) return 1;
+        reader.extractFeatures(features);
+
+        auto start = chrono::steady_clock::now();
+        updateBenchmarkCanvas(chart, geometry, reader, features);
+        updateTimes.add(start);
+
+        start = chrono::steady_clock::now();
+        chart.canvas->SaveAs(pngFileName.c_str());
+        pngTimes.add(start);
+    }
+    unlink(pngFileName.c_str());
+
+    // Output backends: the rendered events again through each PlotOutput, with encoding behind rendering
+    vector<OutputResult> outputResults;
+    OutputLayout outputLayout;
+    outputLayout.directory = "/tmp";
+    outputLayout.pack = options.pack;
+    RasterImage raster;
+    for (const string &format : options.outputs) {
+        OutputResult result;
+        result.format = format;
+        vector<string> targets;
+        auto start = chrono::steady_clock::now();
+        PlotOutput output(format, 1, outputLayout, Form("waveforms_benchmark_%d_batch", (int)getpid()));
+        if (output.packed()) result.format += "+pack";
+        for (Long64_t EventID = 0; EventID < nRendered; EventID++) {
+            if (!reader.load(EventID)) return 1;
+            reader.extractFeatures(features);
+            if (output.usesCanvas()) {
+                lock_guard<mutex> graphics(graphicsMutex()); // The encoder thread paints the previous event
+                updateBenchmarkCanvas(chart, geometry, reader, features);
+            }
+
+            EventScale scale = eventScale(features, nullptr);
+            string name = Form("waveforms_benchmark_%d_%s_Event%lld", (int)getpid(), format.c_str(), EventID);
+            if (output.rasterized()) {
+                layoutRaster(raster, geometry, reader, geometry.pmtRows, geometry.pmtCols, geometry.pmtLayout, scale, EventID);
+                output.saveRaster(raster, name);
+            } else {
+                output.save(chart.canvas, name, [&](const string &documentFormat) {
+                    if (documentFormat == "json") return eventJSON(geometry, reader, features, EventID);
+                    return layoutSVG(geometry, reader, features, geometry.pmtRows, geometry.pmtCols, geometry.pmtLayout, scale);
+                });
+            }
+            targets.push_back(output.target(name));
+        }
+        output.finish();
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        result.encodeSeconds = output.encodeMicroseconds / 1e6;
+        result.files = output.filesWritten;
+        result.bytes = output.bytesWritten;
+        outputResults.push_back(result);
+        for (const string &target : targets) unlink(target.c_str());
+    }
+    deleteBenchmarkCanvas(chart);
+
+    Long64_t nEvents = reader.nEntries;
+    Long64_t bytesRead = reader.bytesRead();
+    Long64_t bytesDecompressed = reader.bytesDecompressed;
+    reader.close();
+    if (options.generate && !options.keep) {
+        unlink(fileName);
+        unlink(waveformCacheFileName(fileName).c_str());
+    }
+
+    // Results
+    ostringstream json;
+    json << "{" << endl
+         << "  \"benchmark\": \"waveforms\"," << endl
+         << "  \"version\": 1," << endl
+         << "  \"config\": {\"geometry\": " << jsonString(geometry.name) << ", \"channels\": " << geometry.nChannels
+         << ", \"samples\": " << geometry.nSamples << ", \"synthetic\": " << (options.generate ? "true" : "false")
+         << ", \"pulse\": " << jsonString(options.synthetic.pulse) << ", \"amplitude\": " << options.synthetic.amplitude
+         << ", \"width_ns\": " << options.synthetic.width << ", \"occupancy\": " << options.synthetic.occupancy
+         << ", \"noise\": " << options.synthetic.noise << ", \"compression\": " << options.synthetic.compression
+         << ", \"seed\": " << options.synthetic.seed << ", \"avx2\": "
+#ifdef __AVX2__
+         << "true"
+#else
+         << "false"
+#endif
+         << "}," << endl
+         << "  \"file\": {\"events\": " << nEvents << ", \"bytes\": " << fileBytes << ", \"generate_s\": " << generateSeconds
+         << ", \"cache\": " << (options.cache ? "true" : "false") << ", \"cache_build_s\": " << cacheSeconds << "}," << endl
+         << "  \"stages\": {" << endl;
+    openTimes.writeJSON(json, "open");
+    json << "," << endl;
+    entryTimes.writeJSON(json, "get_entry");
+    json << "," << endl;
+    featureTimes.writeJSON(json, "feature_scan");
+    json << "," << endl;
+    pulseTimes.writeJSON(json, "pulse_finding");
+    json << "," << endl;
+    buildTimes.writeJSON(json, "canvas_build");
+    json << "," << endl;
+    updateTimes.writeJSON(json, "canvas_update");
+    json << "," << endl;
+    pngTimes.writeJSON(json, "png_encode");
+    json << endl << "  }," << endl
+         << "  \"pulses\": {\"found\": " << nPulses << ", \"per_event\": " << (nEvents > 0 ? (double)nPulses / nEvents : 0) << "}," << endl
+         << "  \"calibration\": {\"build_s\": " << calibrationSeconds << ", \"events_per_s\": " << (calibrationSeconds > 0 ? nEvents / calibrationSeconds : 0)
+         << ", \"mean_baseline\": " << meanBaseline << ", \"mean_noise\": " << meanNoise << ", \"channels_with_gain\": " << nGains << "}," << endl
+         << "  \"throughput\": {\"scan_events_per_s\": " << (scanSeconds > 0 ? nEvents / scanSeconds : 0)
+         << ", \"render_events_per_s\": " << (nRendered > 0 ? nRendered / ((updateTimes.total() + pngTimes.total()) / 1e6) : 0) << "}," << endl
+         << "  \"io\": {\"bytes_read_per_event\": " << (nEvents > 0 ? (double)bytesRead / nEvents : 0)
+         << ", \"bytes_decompressed_per_event\": " << (nEvents > 0 ? (double)bytesDecompressed / nEvents : 0) << "}," << endl
+         << "  \"outputs\": {";
+    for (size_t i = 0; i < outputResults.size(); i++) {
+        const OutputResult &result = outputResults[i];
+        json << (i > 0 ? "," : "") << endl
+             << "    " << jsonString(result.format) << ": {\"events_per_s\": " << (result.seconds > 0 ? nRendered / result.seconds : 0)
+             << ", \"bytes_per_event\": " << (nRendered > 0 ? (double)result.bytes / nRendered : 0)
+             << ", \"files\": " << result.files << ", \"encode_s\": " << result.encodeSeconds << "}";
+    }
+    json << (outputResults.empty() ? "" : "\n  ") << "}," << endl
+         << "  \"peak_rss_mb\": " << peakRSSMB() << endl
+         << "}" << endl;
+
+    if (options.jsonFileName) {
+        ofstream out(options.jsonFileName);
+        if (!(out << json.str())) {
+            cerr << "Error writing " << options.jsonFileName << endl;
+            return 1;
+        }
+        cerr << "Results written to " << options.jsonFileName << endl;
+    } else {
+        cout << json.str();
+    }
+    return 0;
+}
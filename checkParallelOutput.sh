@@ -0,0 +1,36 @@
+#!/bin/sh
+# Check that rendering on several workers writes the same files as a serial run: generates a small synthetic file
+# with benchmarkWaveforms, renders its events with -j 1 and -j <workers> with both tools in the png, svg and raster
+# formats, and compares the two output directories byte for byte. Run it from the directory of the built tools:
+#   ./checkParallelOutput.sh [workers] [events]
+# Exits with status 1 if any output differs.
+workers=${1:-$(nproc)}
+events=${2:-24}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+if ! ./benchmarkWaveforms --events "$events" --file "$dir/check.root" --keep --png-events 1 --json "$dir/benchmark.json" >/dev/null; then
+    echo "Error: can't generate $dir/check.root" >&2
+    exit 1
+fi
+
+status=0
+for tool in ./onlyPMTsWaveform "./waveformsadcValWITHareaBMof Specific Event"; do
+    for format in png svg raster; do
+        for run in serial parallel; do
+            [ $run = serial ] && j=1 || j=$workers
+            if ! "$tool" -j "$j" --output $format --output-dir "$dir/$run" "$dir/check.root" "0-$((events - 1))" >/dev/null; then
+                echo "Error: $tool -j $j --output $format failed" >&2
+                status=1
+            fi
+        done
+        if diff -r "$dir/serial" "$dir/parallel" >/dev/null; then
+            echo "OK        $tool --output $format: -j 1 and -j $workers write the same $(find "$dir/serial" -type f | wc -l) files"
+        else
+            echo "DIFFERENT $tool --output $format: -j 1 and -j $workers outputs differ"
+            status=1
+        fi
+        rm -rf "$dir/serial" "$dir/parallel"
+    done
+done
+exit $status
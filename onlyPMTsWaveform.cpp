@@ -1,5 +1,8 @@
 //This code gives all PMTs' waveform and creates a combined canvas based on channel mapping. It also accepts eventID from the terminal.
 // It displays BM  and Area on the plot.
+// A range or list of events (e.g. 0-5000, 1,5,9 or @ids.txt) can be given instead of a single EventID;
+// the file and canvases are then opened once and reused for every event.
+// Several files (a glob, a comma-separated list or @files.txt) are processed as one run with run-global EventIDs.
 #include <iostream>
 #include <TFile.h>
 #include <TTree.h>
@@ -7,95 +10,65 @@
 #include <TCanvas.h>
 #include <TAxis.h>
 #include <TH1F.h>
+#include <TROOT.h>
+#include <TStopwatch.h>
 #include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
 #include <algorithm>
+#include <numeric>
 #include <cmath>
 #include "TLatex.h"
+#include "EventList.h"
+#include "WaveformReader.h"
+#include "WaveformCacheBuilder.h"
+#include "DetectorGeometry.h"
+#include "WaveformFeatures.h"
+#include "WorkerPool.h"
+#include "EventPredicate.h"
+#include "EventClassifier.h"
+#include "ToolOptions.h"
+#include "WaveformPlot.h"
+#include "PlotOutput.h"
+#include "OutputLayout.h"
+#include "PulseTable.h"
+#include "Calibration.h"
+#include "Profiler.h"
+#include "WaveformExport.h"
+#include "EventRenderer.h"
 
 using namespace std;
 
-// Function to round up a value to the nearest bin size
-double roundUpToBin(double value, double binSize) {
-    return ceil((value + 0.5) / binSize) * binSize;
-}
-
-// Main function to process the ROOT file and generate plots
-void lowlight(const char *fileName, int EventID) {
-    // Open the ROOT file
-    TFile *file = TFile::Open(fileName);
-    if (!file || file->IsZombie()) {
-        cerr << "Error opening file: " << fileName << endl;
-        return;
-    }
-
-    // Access the TTree named "tree" from the ROOT file
-    TTree *tree = (TTree*)file->Get("tree");
-    if (!tree) {
-        cerr << "Error accessing TTree 'tree'!" << endl;
-        file->Close();
-        return;
-    }
-
-    // Declare variables to store data from the TTree
-    Short_t adcVal[23][45]; // ADC values for 23 channels and 45 time bins
-    Double_t area[23];      // Area for each channel
-    Double_t baselineMean[23]; // Baseline mean for each channel
-
-    // Set branch addresses to read data from the TTree
-    tree->SetBranchAddress("adcVal", adcVal);
-    tree->SetBranchAddress("area", area);
-    tree->SetBranchAddress("baselineMean", baselineMean);
-
-    // Get the total number of entries in the TTree
-    Long64_t nEntries = tree->GetEntries();
-    if (EventID < 0 || EventID >= nEntries) {
-        cerr << "Error: EventID " << EventID << " is out of range (0-" << nEntries-1 << ")" << endl;
-        file->Close();
-        return;
-    }
-
-    // Load the specified event into memory
-    tree->GetEntry(EventID);
-
-    // Find the maximum ADC value across all channels and time bins for this event
-    double maxADC = 0;
-    for (int i = 0; i < 23; i++) {
-        for (int k = 0; k < 45; k++) {
-            if (adcVal[i][k] > maxADC) {
-                maxADC = adcVal[i][k];
-            }
-        }
-    }
-
-    // Round up the maximum ADC value to the nearest 100 for better y-axis scaling
-    maxADC = roundUpToBin(maxADC, 10);
-
-    // Mapping of PMT channels
-    int pmtChannelMap[12] = {0, 10, 7, 2, 6, 3, 8, 9, 11, 4, 5, 1};
-
-    // Define the layout of PMT channels on the canvas
-    int layout[4][3] = {
-        {9, 3, 7},  // Row 1: PMT 10, PMT 4, PMT 8
-        {5, 4, 8},  // Row 2: PMT 6, PMT 5, PMT 9
-        {0, 6, 1},  // Row 3: PMT 1, PMT 7, PMT 2
-        {10, 11, 2} // Row 4: PMT 11, PMT 12, PMT 3
-    };
+// Detector geometry selected with --geometry; the layout of PMT channels on the canvas is its pmt_row grid.
+// Set in main before any worker starts.
+DetectorGeometry geometry = defaultGeometry();
+OutputLayout outputLayout; // Output directory and sharding, set from the command line
+PulseFinderConfig pulseFinder;
+bool overlayPulses = false; // Mark the pulses found on the plots
+RunCalibration calibration; // Calibration tables of the run for calibrated plots, empty for raw ADC counts
 
+// Build the master canvas with its pad skeleton, the individual canvases, and draw the plot objects on them
+void buildCanvases(EventCanvases &canvases, int worker) {
     // Create a master canvas for the combined plot
-    TCanvas *masterCanvas = new TCanvas("MasterCanvas", "Combined PMT Waveforms", 3600, 3000);
-    masterCanvas->Divide(3, 4, 0.007, 0.009); // Divide canvas into 3x4 pads with minimal spacing
+    canvases.masterCanvas = new TCanvas(Form("MasterCanvas%d", worker), "Combined PMT Waveforms", 3600, 3000);
+    canvases.masterCanvas->Divide(geometry.pmtCols, geometry.pmtRows, 0.007, 0.009); // Divide canvas into pads with minimal spacing
 
     // Adjust margins to create space in the bottom-left corner
-    masterCanvas->SetLeftMargin(0.10);  // Increase left margin
-    masterCanvas->SetRightMargin(0.05);
-    masterCanvas->SetTopMargin(0.05);
-    masterCanvas->SetBottomMargin(0.10); // Increase bottom margin
+    canvases.masterCanvas->SetLeftMargin(0.10);  // Increase left margin
+    canvases.masterCanvas->SetRightMargin(0.05);
+    canvases.masterCanvas->SetTopMargin(0.05);
+    canvases.masterCanvas->SetBottomMargin(0.10); // Increase bottom margin
+
+    canvases.combinedPlots.assign(geometry.nPMTs(), WaveformPlot());
+    canvases.individualPlots.assign(geometry.nPMTs(), WaveformPlot());
 
     // Loop through the layout to create individual PMT plots
-    for (int row = 0; row < 4; row++) {
-        for (int col = 0; col < 3; col++) {
-            int padPosition = row * 3 + col + 1; // Calculate pad position (1-12)
-            masterCanvas->cd(padPosition); // Switch to the specific pad
+    for (int row = 0; row < geometry.pmtRows; row++) {
+        for (int col = 0; col < geometry.pmtCols; col++) {
+            int padPosition = row * geometry.pmtCols + col + 1; // Calculate pad position
+            canvases.masterCanvas->cd(padPosition); // Switch to the specific pad
 
             // Reduce margins for individual pads
             gPad->SetLeftMargin(0.15);  // Increase left margin for individual pads
@@ -104,129 +77,207 @@ void lowlight(const char *fileName, int EventID) {
             gPad->SetBottomMargin(0.15); // Increase bottom margin for individual pads
 
             // Get the PMT channel index from the layout
-            int pmtIndex = layout[row][col];
-            int adcIndex = pmtChannelMap[pmtIndex]; // Map PMT channels
+            int pmtIndex = geometry.pmtLayout[padPosition - 1];
+            if (pmtIndex < 0) continue; // Empty pad
+            WaveformPlot &plot = canvases.combinedPlots[pmtIndex];
 
             // Create a TGraph to plot the ADC values
-            TGraph *graph = new TGraph();
-
-            // Fill the TGraph with ADC values
-            for (int k = 0; k < 45; k++) {
-                double time = (k + 1) * 16.0;
-                if (time > 720) break;
-                double adcValue = adcVal[adcIndex][k];
-                graph->SetPoint(k, time, adcValue);
-            }
-            graph->SetLineWidth(3);     // Set line width to 3 for thicker lines
-            graph->SetLineColor(kBlack); // Set line color to black
-
-            // Set the title for the plot
-            TString title = Form("PMT %d", pmtIndex + 1);
-            graph->SetTitle("");
-            graph->GetXaxis()->SetTitle("Time (ns)");
-            graph->GetYaxis()->SetTitle("ADC Value (mV)");
+            plot.graph = makeWaveformGraph(geometry.nSamples);
+            plot.graph->SetTitle("");
+            plot.graph->GetXaxis()->SetTitle("Time (ns)");
+            plot.graph->GetYaxis()->SetTitle("ADC Value (mV)");
 
             // Set the axis title sizes
-            graph->GetXaxis()->SetTitleSize(0.07); // Set x-axis title size
-            graph->GetYaxis()->SetTitleSize(0.07); // Set y-axis title size
+            plot.graph->GetXaxis()->SetTitleSize(0.07); // Set x-axis title size
+            plot.graph->GetYaxis()->SetTitleSize(0.07); // Set y-axis title size
 
             // Set the axis title offsets
-            graph->GetXaxis()->SetTitleOffset(1.2); // Increase x-axis title offset
-            graph->GetYaxis()->SetTitleOffset(1.0); // Set y-axis title offset
+            plot.graph->GetXaxis()->SetTitleOffset(1.2); // Increase x-axis title offset
+            plot.graph->GetYaxis()->SetTitleOffset(1.0); // Set y-axis title offset
 
-            graph->SetMinimum(170);   // Set y-axis starting value
-            graph->SetMaximum(maxADC); // Set y-axis maximum based on max ADC value
-            graph->GetXaxis()->SetRangeUser(0, 720);
-            graph->Draw("AL"); // Draw the graph
+            plot.graph->GetXaxis()->SetRangeUser(0, geometry.timeWindow());
+            plot.graph->Draw("AL"); // Draw the graph
 
             // Add the title to the plot
-            TLatex *latexTitle = new TLatex();
-            latexTitle->SetTextSize(0.12);
-            latexTitle->SetTextAlign(22);
-            latexTitle->SetNDC(true);
-            latexTitle->DrawLatex(0.5, 0.94, title);
+            plot.title = makeLabel(0.5, 0.94, 0.12, 22);
+            plot.title->SetTitle(Form("PMT %d", pmtIndex + 1));
 
             // Add area and baselineMean information with colored text
-            TLatex *infoArea = new TLatex();
-            infoArea->SetTextSize(0.04);
-            infoArea->SetTextAlign(13);
-            infoArea->SetNDC(true);
-            infoArea->SetTextColor(kBlue); // Blue color for Area
-            infoArea->DrawLatex(0.2, 0.85, Form("Area: %.2f", area[adcIndex]));
-
-            TLatex *infoBaseline = new TLatex();
-            infoBaseline->SetTextSize(0.04);
-            infoBaseline->SetTextAlign(13);
-            infoBaseline->SetNDC(true);
-            infoBaseline->SetTextColor(kRed); // Red color for Baseline Mean
-            infoBaseline->DrawLatex(0.2, 0.80, Form("Baseline Mean: %.2f", baselineMean[adcIndex]));
+            plot.infoArea = makeLabel(0.2, 0.85, 0.04, 13, kBlue);         // Blue color for Area
+            plot.infoBaseline = makeLabel(0.2, 0.80, 0.04, 13, kRed);      // Red color for Baseline Mean
+            plot.infoPeak = makeLabel(0.2, 0.75, 0.04, 13, kGreen + 2);    // Green color for the peak
+            if (overlayPulses) plot.addPulseOverlay(0.2, 0.70, 0.04);
         }
     }
 
-    // Save the combined canvas as a PNG file
-    TString combinedChartFileName = Form("/root/gears/new/CombinedChart_SpecificLayout_%s_Event%d.png", fileName, EventID);
-    masterCanvas->SaveAs(combinedChartFileName);
-    cout << "Combined chart saved as " << combinedChartFileName << endl;
-
-    // Save individual PMT plots
-    for (int i = 0; i < 12; i++) {
-        TString individualPMTFileName = Form("/root/gears/new/PMT%d_%s_Event%d.png", i + 1, fileName, EventID);
-        TCanvas *individualCanvas = new TCanvas(Form("PMT%d_Canvas", i + 1), Form("PMT %d", i + 1), 800, 600);
-        TGraph *graph = new TGraph();
-
-        int adcIndex = pmtChannelMap[i];
-        for (int k = 0; k < 45; k++) {
-            double time = (k + 1) * 16.0;
-            double adcValue = adcVal[adcIndex][k];
-            graph->SetPoint(k, time, adcValue);
-        }
+    canvases.individualCanvases.assign(geometry.nPMTs(), nullptr);
+    for (int i = 0; i < geometry.nPMTs(); i++) {
+        canvases.individualCanvases[i] = new TCanvas(Form("PMT%d_Canvas%d", i + 1, worker), Form("PMT %d", i + 1), 800, 600);
+        WaveformPlot &plot = canvases.individualPlots[i];
 
-        graph->SetTitle(Form("PMT %d", i + 1));
-        graph->GetXaxis()->SetTitle("Time (ns)");
-        graph->GetYaxis()->SetTitle("ADC Value(mV)");
+        plot.graph = makeWaveformGraph(geometry.nSamples);
+        plot.graph->SetLineWidth(1);
+        plot.graph->SetTitle(Form("PMT %d", i + 1));
+        plot.graph->GetXaxis()->SetTitle("Time (ns)");
+        plot.graph->GetYaxis()->SetTitle("ADC Value(mV)");
 
         // Set the axis title sizes for individual plots
-        graph->GetXaxis()->SetTitleSize(0.04); // Set x-axis title size
-        graph->GetYaxis()->SetTitleSize(0.04); // Set y-axis title size
+        plot.graph->GetXaxis()->SetTitleSize(0.04); // Set x-axis title size
+        plot.graph->GetYaxis()->SetTitleSize(0.04); // Set y-axis title size
 
-        graph->SetMinimum(170); // y axis starting for PMTS
-        graph->SetMaximum(maxADC); // Set y-axis maximum based on max ADC value
-        graph->GetXaxis()->SetRangeUser(0, 720);
-        graph->Draw("AL");
+        plot.graph->GetXaxis()->SetRangeUser(0, geometry.timeWindow());
+        plot.graph->Draw("AL");
 
         // Add area and baselineMean information with colored text
-        TLatex *infoArea = new TLatex();
-        infoArea->SetTextSize(0.04);
-        infoArea->SetTextAlign(13);
-        infoArea->SetNDC(true);
-        infoArea->SetTextColor(kBlue); // Blue color for Area
-        infoArea->DrawLatex(0.2, 0.85, Form("Area: %.2f", area[adcIndex]));
-
-        TLatex *infoBaseline = new TLatex();
-        infoBaseline->SetTextSize(0.04);
-        infoBaseline->SetTextAlign(13);
-        infoBaseline->SetNDC(true);
-        infoBaseline->SetTextColor(kRed); // Red color for Baseline Mean
-        infoBaseline->DrawLatex(0.2, 0.80, Form("Baseline Mean: %.2f", baselineMean[adcIndex]));
-
-        individualCanvas->SaveAs(individualPMTFileName);
-        delete individualCanvas;
+        plot.infoArea = makeLabel(0.2, 0.85, 0.04, 13, kBlue);      // Blue color for Area
+        plot.infoBaseline = makeLabel(0.2, 0.80, 0.04, 13, kRed);   // Red color for Baseline Mean
+        plot.infoPeak = makeLabel(0.2, 0.75, 0.04, 13, kGreen + 2); // Green color for the peak
+        if (overlayPulses) plot.addPulseOverlay(0.2, 0.70, 0.04);
     }
+}
 
-    // Close the ROOT file
-    file->Close();
+// Put the waveform and numbers of a PMT (from 0) of the loaded event into its plot objects
+void updatePlot(WaveformPlot &plot, const WaveformReader &reader, const EventFeatures &features, int i, const EventScale &scale) {
+    int adcIndex = geometry.adcChannel(i); // Map PMT channels
+    ChannelScale channel = scale.channel(adcIndex);
+    {
+        ProfileScope scope(Profiler::kFill);
+        plot.setSamples(reader.samples(adcIndex), channel);
+    }
+    ProfileScope scope(Profiler::kLabels);
+
+    const ChannelFeatures &f = features.channel[adcIndex];
+    plot.infoArea->SetTitle(Form("Area: %.2f", reader.area[adcIndex]));
+    plot.infoBaseline->SetTitle(Form("Baseline Mean: %.2f", reader.baselineMean[adcIndex]));
+    if (channel.calibrated) {
+        plot.infoPeak->SetTitle(Form("Peak: %.1f %s at %.0f ns, rise %.1f ns", channel.apply(f.peak), channel.unit(), sampleTime(f.peakSample), f.riseTime));
+    } else {
+        plot.infoPeak->SetTitle(Form("Peak: %d at %.0f ns, rise %.1f ns", f.peak, sampleTime(f.peakSample), f.riseTime));
+    }
+    if (plot.pulseMarkers) plot.setPulses(features, adcIndex, channel);
+}
+
+// Update the combined PMT layout on the master canvas to the loaded event
+void drawCombinedCanvas(EventCanvases &canvases, const WaveformReader &reader, const EventFeatures &features, const EventScale &scale) {
+    for (int pad = 0; pad < geometry.pmtRows * geometry.pmtCols; pad++) {
+        int pmtIndex = geometry.pmtLayout[pad];
+        if (pmtIndex < 0) continue;
+        updatePlot(canvases.combinedPlots[pmtIndex], reader, features, pmtIndex, scale);
+        canvases.masterCanvas->GetPad(pad + 1)->Modified();
+    }
+}
+
+// Update the individual plot of a PMT (from 0) to the loaded event
+void drawIndividualPlot(EventCanvases &canvases, const WaveformReader &reader, const EventFeatures &features, int i, const EventScale &scale) {
+    updatePlot(canvases.individualPlots[i], reader, features, i, scale);
+    canvases.individualCanvases[i]->Modified();
+}
+
+// How this tool renders events: the PMT layout chart and one plot per PMT
+EventRenderer toolRenderer() {
+    EventRenderer renderer;
+    renderer.geometry = &geometry;
+    renderer.layout = &outputLayout;
+    renderer.pulseFinder = overlayPulses ? &pulseFinder : nullptr;
+    renderer.calibration = &calibration;
+    renderer.chartRows = geometry.pmtRows;
+    renderer.chartCols = geometry.pmtCols;
+    renderer.chartLayout = &geometry.pmtLayout;
+    renderer.nIndividualPlots = geometry.nPMTs();
+    renderer.buildCanvases = buildCanvases;
+    renderer.drawChart = drawCombinedCanvas;
+    renderer.drawIndividualPlot = drawIndividualPlot;
+    return renderer;
+}
+
+// Main function to process the ROOT file and generate plots for a selection of events.
+// eventSpec lists the events (all events if null), optionally narrowed down by the --select predicate and the
+// --class of the --classify rules.
+// The plots of all events are distributed over the worker threads, each with its own file and canvases (EventRenderer.h).
+void lowlight(const RunFiles &run, const char *eventSpec, const ToolOptions &options) {
+    outputLayout.setRun(run.label());
+    vector<Long64_t> events;
+    if (!selectEvents(run, geometry, outputLayout, eventSpec, options, events)) return;
+    toolRenderer().render(run, events, options.nWorkers, options.output);
+}
+
+// Single event entry point, kept for interactive use from the ROOT prompt
+void lowlight(const char *fileName, int EventID) {
+    ToolOptions options;
+    options.nWorkers = 1;
+    RunFiles run;
+    if (!openRunFiles(fileName, 1, run)) return;
+    lowlight(run, to_string(EventID).c_str(), options);
 }
 
 // Main function to handle command-line arguments
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <root_file> <EventID>" << endl;
+    ToolOptions options;
+    if (!parseToolOptions(argc, argv, options)) return 1;
+    if (options.summary || options.serveSocket || options.follow) {
+        cerr << "Error: --summary, --serve and --follow are only available in the combined PMT/SiPM tool" << endl;
         return 1;
     }
 
-    const char* fileName = argv[1];
-    int EventID = atoi(argv[2]);
-    lowlight(fileName, EventID);
+    // The event list may only be omitted when events are selected by a predicate or classified, the index or cache is built, pulses are found
+    // or the files are calibrated
+    bool eventsOptional = options.selection || options.classRules || options.buildIndex || options.buildCache || options.findPulses || options.calibrate;
+    if (options.args.size() < (eventsOptional ? 1u : 2u) || options.args.size() > 2) {
+        printToolUsage(argv[0]);
+        return 1;
+    }
+
+    if (options.eventClass && !options.classRules) {
+        cerr << "Error: --class needs the rules given with --classify" << endl;
+        return 1;
+    }
+
+    if (!loadDetectorGeometry(options.geometry, geometry)) return 1;
+    if (!isOutputFormat(options.output)) {
+        cerr << "Error: unknown output format '" << options.output << "' (" << outputFormatNames << ")" << endl;
+        return 1;
+    }
+    if (geometry.pmtLayout.empty()) {
+        cerr << "Error: detector geometry '" << geometry.name << "' has no pmt_row layout" << endl;
+        return 1;
+    }
+
+    outputLayout.directory = options.outputDir;
+    outputLayout.pack = options.pack;
+    if (!parseOutputSharding(options.shard, outputLayout)) return 1;
+    pulseFinder.threshold = pulseFinder.minRise = options.pulseThreshold;
+    overlayPulses = options.pulses;
+
+    gROOT->SetBatch(true); // No windows are needed, all plots are written to files
+
+    RunFiles run;
+    if (!openRunFiles(options.args[0], options.nWorkers, run)) return 1;
+    const char* eventSpec = options.args.size() > 1 ? options.args[1] : nullptr;
+
+    if (options.buildCache) {
+        for (const string &file : run.fileNames) {
+            if (!buildWaveformCache(file.c_str(), geometry, options.nWorkers)) return 1;
+        }
+    }
+    if (options.buildIndex) {
+        EventIndex index;
+        if (!loadRunIndex(run, geometry, index, options.nWorkers, true)) return 1;
+    }
+    if (options.findPulses && !findRunPulses(run, geometry, pulseFinder, options.nWorkers)) return 1;
+    if (options.calibrate || options.calibrated) {
+        if (!loadRunCalibration(run, geometry, pulseFinder, options.calibrationFile, calibration, options.nWorkers, options.calibrate)) return 1;
+        printRunCalibration(calibration, geometry);
+        if (!options.calibrated) calibration = RunCalibration(); // Only the tables were asked for, the plots stay in ADC counts
+    }
+    if (!eventSpec && !options.selection && !options.classRules) return 0; // Only the cache, index, pulse or calibration tables were asked for
+
+    if (options.profile || options.traceFile) profiler().start(options.profileRSS);
+    lowlight(run, eventSpec, options);
+    if (profiler().enabled) {
+        profiler().stop();
+        if (options.profile) profiler().report(cout);
+        if (options.traceFile && profiler().writeTrace(options.traceFile)) cout << "Trace saved as " << options.traceFile << endl;
+    }
 
     return 0;
 }
@@ -1,6 +1,13 @@
 //This code gives the plots of waveforms and creates a combined canvas according to the physical location of the PMTS/SiPMs.
 //( EventID is  specified, so it gives a plot of the specific event).It also creates a legend on Combined canvas .
 // It also prints baselineMean and area on each canvas and combined canvas. 
+// A range or list of events (e.g. 0-5000, 1,5,9 or @ids.txt) can be given instead of a single EventID;
+// the file and canvases are then opened once and reused for every event.
+// With --summary all selected events are summarized in one chart of persistence histograms and mean/RMS waveforms.
+// With --serve the file stays open and plots are rendered on request over a Unix domain socket.
+// With --follow the file is watched while the DAQ writes it, and the newest event and a running summary are redrawn.
+// Several files (a glob, a comma-separated list or @files.txt) are processed as one run with run-global EventIDs.
+// With --calibrated every channel is drawn as its baseline-subtracted signal in photoelectrons (Calibration.h).
 
 #include <iostream>
 #include <TFile.h>
@@ -9,10 +16,41 @@
 #include <TCanvas.h>
 #include <TAxis.h>
 #include <TH1F.h>
+#include <TH2F.h>
+#include <TROOT.h>
+#include <TStopwatch.h>
+#include <TError.h>
 #include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <cstdlib>
 #include <algorithm>
+#include <numeric>
 #include <cmath>
+#include <chrono>
+#include <thread>
 #include "TLatex.h"
+#include "EventList.h"
+#include "WaveformReader.h"
+#include "WaveformCacheBuilder.h"
+#include "DetectorGeometry.h"
+#include "WaveformFeatures.h"
+#include "WorkerPool.h"
+#include "EventPredicate.h"
+#include "EventClassifier.h"
+#include "ToolOptions.h"
+#include "WaveformSummary.h"
+#include "PlotServer.h"
+#include "FileWatcher.h"
+#include "WaveformPlot.h"
+#include "PlotOutput.h"
+#include "OutputLayout.h"
+#include "PulseTable.h"
+#include "Calibration.h"
+#include "Profiler.h"
+#include "WaveformExport.h"
+#include "EventRenderer.h"
 
 using namespace std;
 
@@ -21,264 +59,556 @@ double roundUpToBin(double value, double binSize) {
     return ceil((value + 0.5) / binSize) * binSize;
 }
 
-// Main function to process the ROOT file and generate plots
-void lowlight(const char *fileName, int EventID) {
-    // Open the ROOT file
-    TFile *file = TFile::Open(fileName);
-    if (!file || file->IsZombie()) {
-        cerr << "Error opening file: " << fileName << endl;
-        return;
+// Detector geometry selected with --geometry; the layout of PMT and SiPM channels on the canvas is its
+// combined_row grid. Set in main before any worker starts.
+DetectorGeometry geometry = defaultGeometry();
+OutputLayout outputLayout; // Output directory and sharding, set from the command line
+PulseFinderConfig pulseFinder;
+bool overlayPulses = false; // Mark the pulses found on the plots
+RunCalibration calibration; // Calibration tables of the run for calibrated plots, empty for raw ADC counts
+
+// Build the master canvas with its pad skeleton and global labels
+TCanvas *buildMasterCanvas(int worker) {
+    // Create a master canvas for the combined plot
+    TCanvas *masterCanvas = new TCanvas(Form("MasterCanvas%d", worker), "Combined PMT and SiPM Waveforms", 3600, 3000);
+    masterCanvas->Divide(geometry.combinedCols, geometry.combinedRows, 0.002, 0.002); // Divide canvas into pads with minimal spacing
+
+    // Reduce margins for the master canvas
+    masterCanvas->SetLeftMargin(0.02);
+    masterCanvas->SetRightMargin(0.02);
+    masterCanvas->SetTopMargin(0.02);
+    masterCanvas->SetBottomMargin(0.02);
+
+    // Add global labels to the master canvas
+    masterCanvas->cd(0);
+    TLatex *textbox = new TLatex();
+    textbox->SetTextSize(0.02);
+    textbox->SetTextAlign(13);
+    textbox->SetNDC(true);
+    textbox->DrawLatex(0.01, 0.10, Form("X axis: Time (0-%.0f) ns", geometry.timeWindow()));
+    textbox->DrawLatex(0.01, 0.08, calibration.empty() ? "Y axis: ADC values(mV)" : "Y axis: signal above baseline (PE)");
+    delete textbox; // DrawLatex draws copies owned by the canvas
+
+    for (int pad = 0; pad < geometry.combinedRows * geometry.combinedCols; pad++) {
+        if (geometry.combinedLayout[pad] >= 0) {
+            masterCanvas->cd(pad + 1);
+
+            // Reduce margins for individual pads
+            gPad->SetLeftMargin(0.05);
+            gPad->SetRightMargin(0.05);
+            gPad->SetTopMargin(0.05);
+            gPad->SetBottomMargin(0.05);
+        }
     }
+    return masterCanvas;
+}
 
-    // Access the TTree named "tree" from the ROOT file
-    TTree *tree = (TTree*)file->Get("tree");
-    if (!tree) {
-        cerr << "Error accessing TTree 'tree'!" << endl;
-        file->Close();
-        return;
+// Build the master canvas and the individual canvases, and draw the plot objects on them
+void buildCanvases(EventCanvases &canvases, int worker) {
+    canvases.masterCanvas = buildMasterCanvas(worker);
+    canvases.combinedPlots.assign(geometry.nDetectorChannels(), WaveformPlot());
+    canvases.individualPlots.assign(geometry.nDetectorChannels(), WaveformPlot());
+
+    // Loop through the layout to create individual plots
+    for (int pad = 0; pad < geometry.combinedRows * geometry.combinedCols; pad++) {
+        int detectorChannel = geometry.combinedLayout[pad];
+        if (detectorChannel >= 0) {
+            canvases.masterCanvas->cd(pad + 1);
+            WaveformPlot &plot = canvases.combinedPlots[detectorChannel];
+
+            // Create a TGraph to plot the ADC values
+            plot.graph = makeWaveformGraph(geometry.nSamples);
+            plot.graph->SetTitle("");
+            plot.graph->GetXaxis()->SetTitle("Time (ns)");
+            plot.graph->GetYaxis()->SetTitle("ADC Value (mV)");
+            plot.graph->GetXaxis()->SetRangeUser(0, geometry.timeWindow());
+            plot.graph->Draw("AL"); // Draw the graph
+
+            // Add the title to the plot
+            plot.title = makeLabel(0.5, 0.94, 0.14, 22);
+            plot.title->SetTitle(geometry.channelName(detectorChannel).c_str());
+
+            // Add area and baselineMean information with colored text
+            plot.infoArea = makeLabel(0.08, 0.90, 0.08, 13, kBlue);      // Blue color for Area
+            plot.infoBaseline = makeLabel(0.08, 0.85, 0.08, 13, kRed);   // Red color for Baseline Mean
+            plot.infoPeak = makeLabel(0.08, 0.80, 0.08, 13, kGreen + 2); // Green color for the peak
+            if (overlayPulses) plot.addPulseOverlay(0.08, 0.75, 0.08);
+        }
     }
 
-    // Declare variables to store data from the TTree
-    Short_t adcVal[23][45]; // ADC values for 23 channels and 45 time bins
-    Double_t area[23];      // Area for each channel
-    Double_t baselineMean[23]; // Baseline mean for each channel
-
-    // Set branch addresses to read data from the TTree
-    tree->SetBranchAddress("adcVal", adcVal);
-    tree->SetBranchAddress("area", area);
-    tree->SetBranchAddress("baselineMean", baselineMean);
-
-    // Get the total number of entries in the TTree
-    Long64_t nEntries = tree->GetEntries();
-    if (EventID < 0 || EventID >= nEntries) {
-        cerr << "Error: EventID " << EventID << " is out of range (0-" << nEntries-1 << ")" << endl;
-        file->Close();
-        return;
+    canvases.individualCanvases.assign(geometry.nDetectorChannels(), nullptr);
+    for (int detectorChannel = 0; detectorChannel < geometry.nDetectorChannels(); detectorChannel++) {
+        bool isSiPM = geometry.isSiPM(detectorChannel);
+        string name = geometry.channelName(detectorChannel);
+        canvases.individualCanvases[detectorChannel] = new TCanvas(Form("%s%d_Canvas%d", isSiPM ? "SiPM" : "PMT", geometry.channelNumber(detectorChannel), worker),
+                                                                   name.c_str(), 800, 600);
+        WaveformPlot &plot = canvases.individualPlots[detectorChannel];
+
+        plot.graph = makeWaveformGraph(geometry.nSamples);
+        plot.graph->SetTitle(name.c_str());
+        plot.graph->GetXaxis()->SetTitle("Time (ns)");
+        plot.graph->GetYaxis()->SetTitle(isSiPM ? "ADC Value" : "ADC Value(mV)");
+        plot.graph->GetXaxis()->SetRangeUser(0, geometry.timeWindow());
+        plot.graph->Draw("AL");
+
+        // Add area and baselineMean information with colored text
+        plot.infoArea = makeLabel(0.14, 0.90, 0.04, 13, kBlue);      // Blue color for Area
+        plot.infoBaseline = makeLabel(0.14, 0.85, 0.04, 13, kRed);   // Red color for Baseline Mean
+        plot.infoPeak = makeLabel(0.14, 0.80, 0.04, 13, kGreen + 2); // Green color for the peak
+        if (overlayPulses) plot.addPulseOverlay(0.14, 0.75, 0.04);
     }
+}
 
-    // Load the specified event into memory
-    tree->GetEntry(EventID);
+// Put the waveform and numbers of the loaded event into the plot objects of a channel
+void updatePlot(WaveformPlot &plot, const WaveformReader &reader, const EventFeatures &features, int adcIndex, const EventScale &scale,
+                const char *baselineFormat, bool showRiseTime) {
+    ChannelScale channel = scale.channel(adcIndex);
+    {
+        ProfileScope scope(Profiler::kFill);
+        plot.setSamples(reader.samples(adcIndex), channel);
+    }
+    ProfileScope scope(Profiler::kLabels);
+
+    const ChannelFeatures &f = features.channel[adcIndex];
+    plot.infoArea->SetTitle(Form("Area: %.2f", reader.area[adcIndex]));
+    plot.infoBaseline->SetTitle(Form(baselineFormat, reader.baselineMean[adcIndex]));
+    string peak = channel.calibrated ? Form("Peak: %.1f %s", channel.apply(f.peak), channel.unit()) : Form("Peak: %d", f.peak);
+    if (showRiseTime) {
+        plot.infoPeak->SetTitle(Form("%s at %.0f ns, rise %.1f ns", peak.c_str(), sampleTime(f.peakSample), f.riseTime));
+    } else {
+        plot.infoPeak->SetTitle(Form("%s at %.0f ns", peak.c_str(), sampleTime(f.peakSample)));
+    }
+    if (plot.pulseMarkers) plot.setPulses(features, adcIndex, channel);
+}
 
-    // Find the maximum ADC value across all channels and time bins for this event
-    double maxADC = 0;
-    for (int i = 0; i < 23; i++) {
-        for (int k = 0; k < 45; k++) {
-            if (adcVal[i][k] > maxADC) {
-                maxADC = adcVal[i][k];
-            }
+// Update the combined PMT/SiPM layout on the master canvas to the loaded event
+void drawCombinedCanvas(EventCanvases &canvases, const WaveformReader &reader, const EventFeatures &features, const EventScale &scale) {
+    for (int pad = 0; pad < geometry.combinedRows * geometry.combinedCols; pad++) {
+        int detectorChannel = geometry.combinedLayout[pad];
+        if (detectorChannel >= 0) {
+            updatePlot(canvases.combinedPlots[detectorChannel], reader, features, geometry.adcChannel(detectorChannel), scale, "BM: %.2f", false);
+            canvases.masterCanvas->GetPad(pad + 1)->Modified();
         }
     }
+}
 
-    // Round up the maximum ADC value to the nearest 100 for better y-axis scaling
-    maxADC = roundUpToBin(maxADC, 10);
+// Canvas and plot objects of the PMT-only view (as drawn by onlyPMTsWaveform), served with layout=pmt
+struct PMTView {
+    TCanvas *canvas = nullptr;
+    vector<WaveformPlot> plots; // Indexed by PMT
+};
+
+// Build the canvas of the PMT-only view with its pad skeleton (the geometry's pmt_row grid) and plot objects
+void buildPMTView(PMTView &view, int worker) {
+    // Create the canvas for the PMT-only view
+    view.canvas = new TCanvas(Form("PMTCanvas%d", worker), "Combined PMT Waveforms", 3600, 3000);
+    view.canvas->Divide(geometry.pmtCols, geometry.pmtRows, 0.007, 0.009); // Divide canvas into pads with minimal spacing
+    view.plots.assign(geometry.nPMTs(), WaveformPlot());
+
+    // Adjust margins to create space in the bottom-left corner
+    view.canvas->SetLeftMargin(0.10);  // Increase left margin
+    view.canvas->SetRightMargin(0.05);
+    view.canvas->SetTopMargin(0.05);
+    view.canvas->SetBottomMargin(0.10); // Increase bottom margin
+
+    for (int pad = 0; pad < geometry.pmtRows * geometry.pmtCols; pad++) {
+        view.canvas->cd(pad + 1);
+
+        // Reduce margins for individual pads
+        gPad->SetLeftMargin(0.15);  // Increase left margin for individual pads
+        gPad->SetRightMargin(0.05);
+        gPad->SetTopMargin(0.05);
+        gPad->SetBottomMargin(0.15); // Increase bottom margin for individual pads
+
+        int pmtIndex = geometry.pmtLayout[pad];
+        if (pmtIndex < 0) continue; // Empty pad
+        WaveformPlot &plot = view.plots[pmtIndex];
+        plot.graph = makeWaveformGraph(geometry.nSamples);
+        plot.graph->SetTitle("");
+        plot.graph->GetXaxis()->SetTitle("Time (ns)");
+        plot.graph->GetYaxis()->SetTitle("ADC Value (mV)");
+        plot.graph->GetXaxis()->SetTitleSize(0.07);
+        plot.graph->GetYaxis()->SetTitleSize(0.07);
+        plot.graph->GetXaxis()->SetTitleOffset(1.2);
+        plot.graph->GetYaxis()->SetTitleOffset(1.0);
+        plot.graph->GetXaxis()->SetRangeUser(0, geometry.timeWindow());
+        plot.graph->Draw("AL");
+
+        plot.title = makeLabel(0.5, 0.94, 0.12, 22);
+        plot.title->SetTitle(Form("PMT %d", pmtIndex + 1));
+        plot.infoArea = makeLabel(0.2, 0.85, 0.04, 13, kBlue);
+        plot.infoBaseline = makeLabel(0.2, 0.80, 0.04, 13, kRed);
+        plot.infoPeak = makeLabel(0.2, 0.75, 0.04, 13, kGreen + 2);
+        if (overlayPulses) plot.addPulseOverlay(0.2, 0.70, 0.04);
+    }
+}
 
-    // Mapping of PMT and SiPM channels
-    int pmtChannelMap[12] = {0, 10, 7, 2, 6, 3, 8, 9, 11, 4, 5, 1};
-    int sipmChannelMap[10] = {12, 13, 14, 15, 16, 17, 18, 19, 20, 21};
+// Update the PMT-only view to the loaded event
+void drawPMTView(PMTView &view, const WaveformReader &reader, const EventFeatures &features, const EventScale &scale) {
+    for (int pad = 0; pad < geometry.pmtRows * geometry.pmtCols; pad++) {
+        int pmtIndex = geometry.pmtLayout[pad];
+        if (pmtIndex < 0) continue;
+        updatePlot(view.plots[pmtIndex], reader, features, geometry.adcChannel(pmtIndex), scale, "Baseline Mean: %.2f", true);
+        view.canvas->GetPad(pad + 1)->Modified();
+    }
+}
 
-    // Create a master canvas for the combined plot
-    TCanvas *masterCanvas = new TCanvas("MasterCanvas", "Combined PMT and SiPM Waveforms", 3600, 3000);
-    masterCanvas->Divide(5, 6, 0.002, 0.002); // Divide canvas into 5x6 pads with minimal spacing
+// Update the individual plot of a detector channel (PMTs first, then SiPMs) to the loaded event
+void drawIndividualPlot(EventCanvases &canvases, const WaveformReader &reader, const EventFeatures &features, int detectorChannel, const EventScale &scale) {
+    updatePlot(canvases.individualPlots[detectorChannel], reader, features, geometry.adcChannel(detectorChannel), scale, "BM: %.2f", true);
+    canvases.individualCanvases[detectorChannel]->Modified();
+}
 
-    // Reduce margins for the master canvas
-    masterCanvas->SetLeftMargin(0.02);
-    masterCanvas->SetRightMargin(0.02);
-    masterCanvas->SetTopMargin(0.02);
-    masterCanvas->SetBottomMargin(0.02);
+// How this tool renders events: the combined PMT/SiPM chart and one plot per PMT and SiPM
+EventRenderer toolRenderer() {
+    EventRenderer renderer;
+    renderer.geometry = &geometry;
+    renderer.layout = &outputLayout;
+    renderer.pulseFinder = overlayPulses ? &pulseFinder : nullptr;
+    renderer.calibration = &calibration;
+    renderer.chartRows = geometry.combinedRows;
+    renderer.chartCols = geometry.combinedCols;
+    renderer.chartLayout = &geometry.combinedLayout;
+    renderer.nIndividualPlots = geometry.nDetectorChannels();
+    renderer.buildCanvases = buildCanvases;
+    renderer.drawChart = drawCombinedCanvas;
+    renderer.drawIndividualPlot = drawIndividualPlot;
+    return renderer;
+}
 
-    // Define the layout of PMT and SiPM channels on the canvas
-    int layout[6][5] = {
-        {-1,  -1,  20,  21, -1},
-        {16,  9,   3,   7,  12},
-        {15,  5,   4,   8,   -1},
-        {19, 0,   6,  1,  17},
-        {-1,  10,  11,   2,  13},
-        {-1, 14,   18,  -1, -1}
-    };
+// Draw the persistence histogram with the mean and mean +- RMS waveforms of every channel on the master canvas,
+// in raw ADC counts. Drawing again on the same canvas (follow mode) replaces the previous summary.
+void drawSummaryCanvas(TCanvas *masterCanvas, const WaveformSummary &summary) {
+    double maxADC = roundUpToBin(summary.maxFilledADC(), 10);
 
-    // Add global labels to the master canvas
     masterCanvas->cd(0);
+    TObject *previousLabel = masterCanvas->GetListOfPrimitives()->FindObject("SummaryLabel");
+    if (previousLabel) {
+        masterCanvas->GetListOfPrimitives()->Remove(previousLabel);
+        delete previousLabel;
+    }
     TLatex *textbox = new TLatex();
     textbox->SetTextSize(0.02);
     textbox->SetTextAlign(13);
     textbox->SetNDC(true);
-    textbox->DrawLatex(0.01, 0.10, "X axis: Time (0-720) ns");
-    textbox->DrawLatex(0.01, 0.08, "Y axis: ADC values(mV)");
-
-    // Loop through the layout to create individual plots
-    for (int row = 0; row < 6; row++) {
-        for (int col = 0; col < 5; col++) {
-            int padPosition = layout[row][col];
-            if (padPosition >= 0) {
-                masterCanvas->cd(row * 5 + col + 1);
-
-                // Reduce margins for individual pads
-                gPad->SetLeftMargin(0.05);
-                gPad->SetRightMargin(0.05);
-                gPad->SetTopMargin(0.05);
-                gPad->SetBottomMargin(0.05);
-
-                // Create a TGraph to plot the ADC values
-                TGraph *graph = new TGraph();
-
-                int adcIndex = -1;
-                if (padPosition < 12) {
-                    adcIndex = pmtChannelMap[padPosition]; // Map PMT channels
-                } else {
-                    adcIndex = sipmChannelMap[padPosition - 12]; // Map SiPM channels
+    textbox->DrawLatex(0.01, 0.06, Form("Summary of %lld events", summary.nEvents))->SetName("SummaryLabel");
+    delete textbox; // DrawLatex draws copies owned by the canvas
+
+    TLatex latexTitle;
+    latexTitle.SetTextSize(0.14);
+    latexTitle.SetTextAlign(22);
+    latexTitle.SetNDC(true);
+    int nSamples = summary.nSamples;
+    for (int pad = 0; pad < geometry.combinedRows * geometry.combinedCols; pad++) {
+        int detectorChannel = geometry.combinedLayout[pad];
+        if (detectorChannel >= 0) {
+            masterCanvas->cd(pad + 1);
+            gPad->Clear();
+
+            int adcIndex = geometry.adcChannel(detectorChannel);
+
+            // Persistence: one x bin per sample centered on its time, ADC on y
+            TH2F *persistence = new TH2F(Form("Persistence%d", adcIndex), "", nSamples, 8, 8 + 16 * nSamples,
+                                         summaryADCBins, summaryADCMin, summaryADCMax);
+            persistence->SetDirectory(nullptr);
+            persistence->SetBit(kCanDelete); // Deleted by the next gPad->Clear()
+            for (int k = 0; k < nSamples; k++) {
+                for (int bin = 0; bin < summaryADCBins; bin++) {
+                    persistence->SetBinContent(k + 1, bin + 1, summary.count(adcIndex, k, bin));
                 }
+            }
+            persistence->SetStats(false);
+            persistence->GetXaxis()->SetRangeUser(0, geometry.timeWindow());
+            persistence->GetYaxis()->SetRangeUser(defaultADCFloor, maxADC);
+            persistence->Draw("COL");
+
+            // Mean waveform and the mean +- RMS band
+            TGraph *meanGraph = new TGraph();
+            TGraph *upperGraph = new TGraph();
+            TGraph *lowerGraph = new TGraph();
+            for (int k = 0; k < nSamples; k++) {
+                double time = sampleTime(k);
+                meanGraph->SetPoint(k, time, summary.mean(adcIndex, k));
+                upperGraph->SetPoint(k, time, summary.mean(adcIndex, k) + summary.rms(adcIndex, k));
+                lowerGraph->SetPoint(k, time, summary.mean(adcIndex, k) - summary.rms(adcIndex, k));
+            }
+            meanGraph->SetBit(kCanDelete);
+            upperGraph->SetBit(kCanDelete);
+            lowerGraph->SetBit(kCanDelete);
+            meanGraph->SetLineWidth(3);
+            meanGraph->SetLineColor(kBlack);
+            meanGraph->Draw("L");
+            upperGraph->SetLineColor(kRed);
+            upperGraph->SetLineStyle(2);
+            upperGraph->Draw("L");
+            lowerGraph->SetLineColor(kRed);
+            lowerGraph->SetLineStyle(2);
+            lowerGraph->Draw("L");
+
+            // Add the title to the plot; DrawLatex draws a copy owned by the pad
+            latexTitle.DrawLatex(0.5, 0.94, geometry.channelName(detectorChannel).c_str());
+        }
+    }
+}
 
-                // Fill the TGraph with ADC values
-                for (int k = 0; k < 45; k++) {
-                    double time = (k + 1) * 16.0;
-                    if (time > 720) break;
-                    double adcValue = adcVal[adcIndex][k];
-                    graph->SetPoint(k, time, adcValue);
-                }
+// Summarize the selected events in one pass and save the summary chart
+void summarizeEvents(const RunFiles &run, const vector<Long64_t> &events, int nWorkers) {
+    TStopwatch timer;
+
+    if (events.size() > 1) WaveformReader::enableAsyncPrefetching();
+    WaveformSummary summary(geometry.nChannels, geometry.nSamples);
+    if (!accumulateSummary(run, geometry, events, nWorkers, summary)) return;
+
+    TCanvas *masterCanvas = buildMasterCanvas(0);
+    drawSummaryCanvas(masterCanvas, summary);
+
+    string summaryChartFileName = outputLayout.path(Form("SummaryChart_SpecificLayout_%s.png", outputLayout.runName.c_str()));
+    saveCanvasAtomically(masterCanvas, summaryChartFileName);
+    cout << "Summary chart saved as " << summaryChartFileName << endl;
+
+    timer.Stop();
+    double seconds = timer.RealTime();
+    cout << "Summarized " << summary.nEvents << " events in " << seconds << " s ("
+         << (seconds > 0 ? summary.nEvents / seconds : 0) << " events/s)" << endl;
+    cout << "Peak RSS: " << peakRSSMB() << " MB" << endl;
+}
 
-                // Set the title for the plot
-                TString title;
-                if (padPosition < 12) {
-                    title = Form("PMT %d", padPosition + 1);
-                } else {
-                    title = Form("SiPM %d", padPosition - 11);
+// Keep the files open and render events, by run-global EventID, on request (see PlotServer.h).
+// Returns false if the files can't be opened or the socket can't be set up.
+bool serveEvents(const RunFiles &run, const char *socketPath) {
+    WaveformReader reader;
+    if (!reader.open(run, geometry)) return false;
+
+    EventCanvases canvases;
+    buildCanvases(canvases, 0);
+    PMTView pmtView;
+    if (!geometry.pmtLayout.empty()) buildPMTView(pmtView, 0);
+
+    RasterImage raster;
+    PNGEncoder encoder;
+    EventFeatures features;
+
+    return servePlots(socketPath, [&](const PlotRequest &request, string &bytes, string &error) {
+        if (request.EventID < 0 || request.EventID >= reader.nEntries) {
+            error = Form("EventID %lld is out of range (0-%lld)", request.EventID, reader.nEntries - 1);
+            return false;
+        }
+        if (!reader.load(request.EventID)) {
+            error = "can't read event";
+            return false;
+        }
+        if (request.layout == "pmt" && !pmtView.canvas) {
+            error = "detector geometry has no pmt_row layout";
+            return false;
+        }
+        reader.extractFeatures(features);
+        if (overlayPulses) reader.findPulses(features, pulseFinder);
+        EventScale scale = eventScale(features, calibration.forFile(reader.runFile));
+
+        // Encoded in memory like the --output formats; the data formats don't touch the canvases
+        bool pmt = request.layout == "pmt";
+        int rows = pmt ? geometry.pmtRows : geometry.combinedRows;
+        int cols = pmt ? geometry.pmtCols : geometry.combinedCols;
+        const vector<int> &layout = pmt ? geometry.pmtLayout : geometry.combinedLayout;
+        bool ok = true;
+        if (request.format == "svg") {
+            bytes = layoutSVG(geometry, reader, features, rows, cols, layout, scale);
+        } else if (request.format == "json") {
+            bytes = eventJSON(geometry, reader, features, request.EventID, scale.calibration);
+        } else if (request.format == "raster") {
+            layoutRaster(raster, geometry, reader, rows, cols, layout, scale, request.EventID);
+            ok = encoder.encode(raster, bytes);
+        } else if (pmt) {
+            drawPMTView(pmtView, reader, features, scale);
+            ok = encodeCanvasPNG(pmtView.canvas, request.format == "thumb", bytes);
+        } else {
+            drawCombinedCanvas(canvases, reader, features, scale);
+            ok = encodeCanvasPNG(canvases.masterCanvas, request.format == "thumb", bytes);
+        }
+        if (!ok) error = "can't encode image";
+        return ok;
+    }, plotCacheEntries);
+}
+
+// Follow a file the DAQ is still writing. Whenever entries are appended only the new ones are read, into a running
+// summary, and the combined chart of the newest event and the summary chart are redrawn, at most once per interval.
+void followEvents(const char *fileName, int intervalMs) {
+    WaveformReader reader;
+    if (!reader.open(fileName, geometry, false)) return; // A cache doesn't grow with the file
+    if (intervalMs < 1) intervalMs = 1;
+    FileWatcher watcher;
+    if (!watcher.open(fileName)) {
+        cerr << "Warning: can't watch " << fileName << " for writes, checking every " << intervalMs << " ms" << endl;
+    }
+    installFollowStopHandler();
+    gErrorIgnoreLevel = kWarning; // Don't log every redraw
+
+    EventCanvases canvases;
+    buildCanvases(canvases, 0);
+    canvases.masterCanvas->cd(0);
+    TLatex *eventLabel = makeLabel(0.01, 0.06, 0.02, 13);
+    TCanvas *summaryCanvas = buildMasterCanvas(1);
+    WaveformSummary summary(geometry.nChannels, geometry.nSamples);
+    EventFeatures features;
+
+    outputLayout.setRun(fileName);
+    string latestChartFileName = outputLayout.path(Form("CombinedChart_SpecificLayout_%s_Latest.png", outputLayout.runName.c_str()));
+    string summaryChartFileName = outputLayout.path(Form("SummaryChart_SpecificLayout_%s_Running.png", outputLayout.runName.c_str()));
+    cout << "Following " << fileName << " (" << reader.nEntries << " events so far); updating " << latestChartFileName
+         << " and " << summaryChartFileName << ", Ctrl-C to stop" << endl;
+
+    chrono::milliseconds interval(intervalMs);
+    Long64_t nextEvent = 0; // First event not read yet
+    while (!followStopRequested()) {
+        auto updateStart = chrono::steady_clock::now();
+        reader.refresh();
+        Long64_t firstNew = nextEvent;
+        bool stalled = false; // An entry failed to load
+        if (nextEvent < reader.nEntries) {
+            // Read the new entries, but for no longer than one interval so a large backlog still shows progress.
+            // An entry that can't be read yet (basket not completely flushed) is retried on the next update.
+            reader.setEntryRange(nextEvent, reader.nEntries - 1);
+            while (nextEvent < reader.nEntries && chrono::steady_clock::now() - updateStart < interval) {
+                if (!reader.load(nextEvent)) {
+                    stalled = true;
+                    break;
                 }
-                graph->SetLineWidth(3);     // Set line width to 3 for thicker lines
-                graph->SetLineColor(kBlack); // Set line color to black
-                graph->SetTitle("");
-                graph->GetXaxis()->SetTitle("Time (ns)");
-                graph->GetYaxis()->SetTitle("ADC Value (mV)");
-                graph->SetMinimum(170);   // Set y-axis starting value
-                graph->SetMaximum(maxADC); // Set y-axis maximum based on max ADC value
-                graph->GetXaxis()->SetRangeUser(0, 720);
-                graph->Draw("AL"); // Draw the graph
-
-                // Add the title to the plot
-                TLatex *latexTitle = new TLatex();
-                latexTitle->SetTextSize(0.14);
-                latexTitle->SetTextAlign(22);
-                latexTitle->SetNDC(true);
-                latexTitle->DrawLatex(0.5, 0.94, title);
-
-                // Add area and baselineMean information with colored text
-                TLatex *infoArea = new TLatex();
-                infoArea->SetTextSize(0.08);
-                infoArea->SetTextAlign(13);
-                infoArea->SetNDC(true);
-                infoArea->SetTextColor(kBlue); // Blue color for Area
-                infoArea->DrawLatex(0.08, 0.90, Form("Area: %.2f", area[adcIndex]));
-
-                TLatex *infoBaseline = new TLatex();
-                infoBaseline->SetTextSize(0.08);
-                infoBaseline->SetTextAlign(13);
-                infoBaseline->SetNDC(true);
-                infoBaseline->SetTextColor(kRed); // Red color for Baseline Mean
-                infoBaseline->DrawLatex(0.08, 0.85, Form("BM: %.2f", baselineMean[adcIndex]));
+                summary.fill(reader.adc, reader.channelStride);
+                nextEvent++;
             }
         }
-    }
-
-    // Save the combined canvas as a PNG file
-    TString combinedChartFileName = Form("/root/gears/new/CombinedChart_SpecificLayout_%s_Event%d.png", fileName, EventID);
-    masterCanvas->SaveAs(combinedChartFileName);
-    cout << "Combined chart saved as " << combinedChartFileName << endl;
-
-    // Save individual PMT plots
-    for (int i = 0; i < 12; i++) {
-        TString individualPMTFileName = Form("/root/gears/new/PMT%d_%s_Event%d.png", i + 1, fileName, EventID);
-        TCanvas *individualCanvas = new TCanvas(Form("PMT%d_Canvas", i + 1), Form("PMT %d", i + 1), 800, 600);
-        TGraph *graph = new TGraph();
-
-        int adcIndex = pmtChannelMap[i];
-        for (int k = 0; k < 45; k++) {
-            double time = (k + 1) * 16.0;
-            double adcValue = adcVal[adcIndex][k];
-            graph->SetPoint(k, time, adcValue);
+        if (nextEvent > firstNew) {
+            // The reader still holds the newest event read
+            reader.extractFeatures(features);
+            if (overlayPulses) reader.findPulses(features, pulseFinder);
+            drawCombinedCanvas(canvases, reader, features, eventScale(features, calibration.forFile(0)));
+            eventLabel->SetTitle(Form("Event %lld", nextEvent - 1));
+            canvases.masterCanvas->Modified();
+            saveCanvasAtomically(canvases.masterCanvas, latestChartFileName);
+            drawSummaryCanvas(summaryCanvas, summary);
+            saveCanvasAtomically(summaryCanvas, summaryChartFileName);
+
+            double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - updateStart).count();
+            cout << "Event " << nextEvent - 1 << ": " << nextEvent - firstNew << " new, " << summary.nEvents
+                 << " summarized, updated in " << ms << " ms" << endl;
         }
-        graph->SetLineWidth(3);     // Set line width to 3 for thicker lines
-        graph->SetLineColor(kBlack); // Set line color to black
-        graph->SetTitle(Form("PMT %d", i + 1));
-        graph->GetXaxis()->SetTitle("Time (ns)");
-        graph->GetYaxis()->SetTitle("ADC Value(mV)");
-        graph->SetMinimum(170); // y axis starting for PMTS
-        graph->SetMaximum(maxADC); // Set y-axis maximum based on max ADC value
-        graph->GetXaxis()->SetRangeUser(0, 720);
-        graph->Draw("AL");
+        if (!stalled && nextEvent < reader.nEntries) continue; // Interval used up with backlog left, keep reading
 
-        // Add area and baselineMean information with colored text
-        TLatex *infoArea = new TLatex();
-        infoArea->SetTextSize(0.04);
-        infoArea->SetTextAlign(13);
-        infoArea->SetNDC(true);
-        infoArea->SetTextColor(kBlue); // Blue color for Area
-        infoArea->DrawLatex(0.14, 0.90, Form("Area: %.2f", area[adcIndex]));
-
-        TLatex *infoBaseline = new TLatex();
-        infoBaseline->SetTextSize(0.04);
-        infoBaseline->SetTextAlign(13);
-        infoBaseline->SetNDC(true);
-        infoBaseline->SetTextColor(kRed); // Red color for Baseline Mean
-        infoBaseline->DrawLatex(0.14, 0.85, Form("BM: %.2f", baselineMean[adcIndex]));
-
-        individualCanvas->SaveAs(individualPMTFileName);
-        delete individualCanvas;
+        // Redraw at most once per interval, then sleep until the DAQ writes again (or check again after an interval)
+        auto elapsed = chrono::steady_clock::now() - updateStart;
+        if (elapsed < interval) this_thread::sleep_for(interval - elapsed);
+        watcher.wait(intervalMs);
     }
 
-    // Save individual SiPM plots
-    for (int i = 0; i < 10; i++) {
-        TString individualSiPMFileName = Form("/root/gears/new/SiPM%d_%s_Event%d.png", i + 1, fileName, EventID);
-        TCanvas *individualCanvas = new TCanvas(Form("SiPM%d_Canvas", i + 1), Form("SiPM %d", i + 1), 800, 600);
-        TGraph *graph = new TGraph();
-
-        int adcIndex = sipmChannelMap[i];
-        for (int k = 0; k < 45; k++) {
-            double time = (k + 1) * 16.0;
-            double adcValue = adcVal[adcIndex][k];
-            graph->SetPoint(k, time, adcValue);
-        }
-        graph->SetLineWidth(3);     // Set line width to 3 for thicker lines
-        graph->SetLineColor(kBlack); // Set line color to black
-        graph->SetTitle(Form("SiPM %d", i + 1));
-        graph->GetXaxis()->SetTitle("Time (ns)");
-        graph->GetYaxis()->SetTitle("ADC Value");
-        graph->SetMinimum(170); // y axis starting SiPMs
-        graph->SetMaximum(maxADC); // Set y-axis maximum based on max ADC value
-        graph->GetXaxis()->SetRangeUser(0, 720);
-        graph->Draw("AL");
+    cout << "Followed " << summary.nEvents << " events" << endl;
+    cout << "Peak RSS: " << peakRSSMB() << " MB" << endl;
+    delete summaryCanvas;
+    deleteCanvases(canvases);
+    delete eventLabel;
+}
 
-        // Add area and baselineMean information with colored text
-        TLatex *infoArea = new TLatex();
-        infoArea->SetTextSize(0.04);
-        infoArea->SetTextAlign(13);
-        infoArea->SetNDC(true);
-        infoArea->SetTextColor(kBlue); // Blue color for Area
-        infoArea->DrawLatex(0.14, 0.90, Form("Area: %.2f", area[adcIndex]));
-
-        TLatex *infoBaseline = new TLatex();
-        infoBaseline->SetTextSize(0.04);
-        infoBaseline->SetTextAlign(13);
-        infoBaseline->SetNDC(true);
-        infoBaseline->SetTextColor(kRed); // Red color for Baseline Mean
-        infoBaseline->DrawLatex(0.14, 0.85, Form("BM: %.2f", baselineMean[adcIndex]));
-
-        individualCanvas->SaveAs(individualSiPMFileName);
-        delete individualCanvas;
+// Main function to process the ROOT file and generate plots for a selection of events.
+// eventSpec lists the events (all events if null), optionally narrowed down by the --select predicate and the
+// --class of the --classify rules.
+// The plots of all events are distributed over the worker threads, each with its own file and canvases (EventRenderer.h).
+void lowlight(const RunFiles &run, const char *eventSpec, const ToolOptions &options) {
+    outputLayout.setRun(run.label());
+    vector<Long64_t> events;
+    if (!selectEvents(run, geometry, outputLayout, eventSpec, options, events)) return;
+
+    if (options.summary) {
+        summarizeEvents(run, events, options.nWorkers);
+        return;
     }
+    toolRenderer().render(run, events, options.nWorkers, options.output);
+}
 
-    // Close the ROOT file
-    file->Close();
+// Single event entry point, kept for interactive use from the ROOT prompt
+void lowlight(const char *fileName, int EventID) {
+    ToolOptions options;
+    options.nWorkers = 1;
+    RunFiles run;
+    if (!openRunFiles(fileName, 1, run)) return;
+    lowlight(run, to_string(EventID).c_str(), options);
 }
 
 // Main function to handle command-line arguments
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        cerr << "Usage: " << argv[0] << " <root_file> <EventID>" << endl;
+    ToolOptions options;
+    if (!parseToolOptions(argc, argv, options)) return 1;
+
+    // The event list may only be omitted when events are selected by a predicate, classified, summarized, served, followed, the index or
+    // cache is built, pulses are found or the files are calibrated
+    bool eventsOptional = options.selection || options.classRules || options.buildIndex || options.buildCache || options.findPulses || options.calibrate ||
+                          options.summary || options.serveSocket || options.follow;
+    if (options.args.size() < (eventsOptional ? 1u : 2u) || options.args.size() > 2) {
+        printToolUsage(argv[0]);
+        return 1;
+    }
+
+    if (options.eventClass && !options.classRules) {
+        cerr << "Error: --class needs the rules given with --classify" << endl;
+        return 1;
+    }
+
+    if (!loadDetectorGeometry(options.geometry, geometry)) return 1;
+    if (!isOutputFormat(options.output)) {
+        cerr << "Error: unknown output format '" << options.output << "' (" << outputFormatNames << ")" << endl;
         return 1;
     }
 
-    const char* fileName = argv[1];
-    int EventID = atoi(argv[2]);
-    lowlight(fileName, EventID);
+    outputLayout.directory = options.outputDir;
+    outputLayout.pack = options.pack;
+    if (!parseOutputSharding(options.shard, outputLayout)) return 1;
+    pulseFinder.threshold = pulseFinder.minRise = options.pulseThreshold;
+    overlayPulses = options.pulses;
+
+    gROOT->SetBatch(true); // No windows are needed, all plots are written to files
+
+    RunFiles run;
+    if (!openRunFiles(options.args[0], options.nWorkers, run)) return 1;
+    if (options.buildCache) {
+        for (const string &file : run.fileNames) {
+            if (!buildWaveformCache(file.c_str(), geometry, options.nWorkers)) return 1;
+        }
+    }
+    if (options.calibrate || options.calibrated) {
+        // A file that is still being written has no fixed calibration of its own
+        if (options.follow && !options.calibrationFile) {
+            cerr << "Error: --follow can only be calibrated with a table given with --calibration" << endl;
+            return 1;
+        }
+        if (!loadRunCalibration(run, geometry, pulseFinder, options.calibrationFile, calibration, options.nWorkers, options.calibrate)) return 1;
+        printRunCalibration(calibration, geometry);
+        if (!options.calibrated) calibration = RunCalibration(); // Only the tables were asked for, the plots stay in ADC counts
+    }
+    if (options.follow) {
+        if (run.nFiles() != 1) {
+            cerr << "Error: --follow takes a single file" << endl;
+            return 1;
+        }
+        followEvents(run.fileNames[0].c_str(), options.followInterval);
+        return 0;
+    }
+    if (options.serveSocket) {
+        return serveEvents(run, options.serveSocket) ? 0 : 1;
+    }
+    const char* eventSpec = options.args.size() > 1 ? options.args[1] : nullptr;
+
+    if (options.buildIndex) {
+        EventIndex index;
+        if (!loadRunIndex(run, geometry, index, options.nWorkers, true)) return 1;
+    }
+    if (options.findPulses && !findRunPulses(run, geometry, pulseFinder, options.nWorkers)) return 1;
+    if (!eventSpec && !options.selection && !options.summary && !options.classRules) return 0; // Only the cache, index, pulse or calibration tables were asked for
+
+    if (options.profile || options.traceFile) profiler().start(options.profileRSS);
+    lowlight(run, eventSpec, options);
+    if (profiler().enabled) {
+        profiler().stop();
+        if (options.profile) profiler().report(cout);
+        if (options.traceFile && profiler().writeTrace(options.traceFile)) cout << "Trace saved as " << options.traceFile << endl;
+    }
 
     return 0;
 }